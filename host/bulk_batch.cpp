@@ -0,0 +1,176 @@
+/** \file Host side of the bulk batch read.
+ *
+ * The spans are packed into BULK_LIST requests that each ask for at
+ * most one frame of bytes, splitting long spans where needed.  Since
+ * the spans are packed in order, each answer is the next part of the
+ * output.
+ */
+#include <string.h>
+#include <vector>
+#include "bulk_batch.h"
+#include "bulk_request.h"
+#include "../promdate/bulk.h"
+
+
+typedef struct
+{
+	std::vector<uint8_t> list;
+	uint32_t out_offset;
+	uint32_t out_len;
+} batch_list_t;
+
+
+typedef struct
+{
+	const bulk_span_t * spans;
+	size_t count;
+	uint8_t * out;
+	uint32_t * size;
+	std::vector<batch_list_t> lists;
+} batch_state_t;
+
+
+/** Pack the spans into lists of at most frame_size bytes each */
+static void
+batch_pack(
+	batch_state_t * const b,
+	const uint32_t frame_size
+)
+{
+	uint32_t out_offset = 0;
+	b->lists.clear();
+
+	for (size_t i = 0 ; i < b->count ; i++)
+	{
+		uint32_t start = b->spans[i].start;
+		const uint16_t stride = b->spans[i].stride;
+		uint32_t remaining = b->spans[i].count;
+
+		while (remaining)
+		{
+			if (b->lists.empty()
+			||  b->lists.back().out_len == frame_size
+			||  b->lists.back().list.size() + 8 > BULK_PAYLOAD)
+			{
+				batch_list_t l;
+				l.out_offset = out_offset;
+				l.out_len = 0;
+				b->lists.push_back(l);
+			}
+
+			batch_list_t & l = b->lists.back();
+			uint32_t n = frame_size - l.out_len;
+			if (n > remaining)
+				n = remaining;
+
+			uint8_t entry[8];
+			if (n == 1)
+			{
+				bulk_put32(&entry[0], start);
+				l.list.insert(l.list.end(), entry, entry + 4);
+			} else {
+				bulk_put32(&entry[0], start | BULK_LIST_RANGE);
+				bulk_put16(&entry[4], stride);
+				bulk_put16(&entry[6], n);
+				l.list.insert(l.list.end(), entry, entry + 8);
+			}
+
+			l.out_len += n;
+			out_offset += n;
+			start += (uint32_t) stride * n;
+			remaining -= n;
+		}
+	}
+}
+
+
+static int64_t
+batch_start(
+	void * const priv,
+	const uint32_t size,
+	const uint32_t frame_size
+)
+{
+	batch_state_t * const b = (batch_state_t *) priv;
+	*b->size = size;
+
+	for (size_t i = 0 ; i < b->count ; i++)
+	{
+		const bulk_span_t * const s = &b->spans[i];
+		if (s->count == 0)
+			continue;
+		const uint64_t last = s->start + (uint64_t) s->stride * (s->count - 1);
+		if (s->start >= size || last >= size)
+			return -1;
+	}
+
+	batch_pack(b, frame_size);
+	return b->lists.size();
+}
+
+
+static uint16_t
+batch_request(
+	void * const priv,
+	const uint32_t seq,
+	uint8_t * const payload
+)
+{
+	const batch_state_t * const b = (const batch_state_t *) priv;
+	const std::vector<uint8_t> & list = b->lists[seq].list;
+	memcpy(payload, list.data(), list.size());
+	return list.size();
+}
+
+
+static int
+batch_answer(
+	void * const priv,
+	const uint32_t seq,
+	const uint8_t type,
+	const uint8_t * const payload,
+	const uint16_t len
+)
+{
+	batch_state_t * const b = (batch_state_t *) priv;
+	const batch_list_t & l = b->lists[seq];
+
+	if (type != BULK_DATA)
+		return -1;
+	if (len != l.out_len)
+		return 0;
+
+	memcpy(b->out + l.out_offset, payload, len);
+	return 1;
+}
+
+
+int
+bulk_batch(
+	const int fd,
+	const bulk_span_t * const spans,
+	const size_t count,
+	uint8_t * const out,
+	uint32_t * const size,
+	const int timeout_ms
+)
+{
+	batch_state_t b;
+	b.spans = spans;
+	b.count = count;
+	b.out = out;
+	b.size = size;
+	*size = 0;
+
+	const bulk_request_t req = {
+		BULK_LIST,
+		batch_start,
+		batch_request,
+		batch_answer,
+		NULL,
+		&b,
+		timeout_ms,
+	};
+
+	return bulk_request(fd, &req);
+}
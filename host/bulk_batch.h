@@ -0,0 +1,36 @@
+/** \file
+ * Host side of the bulk batch read described in promdate/bulk.h.
+ */
+#ifndef _host_bulk_batch_h_
+#define _host_bulk_batch_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** count bytes of the image at start, start + stride and so on */
+typedef struct
+{
+	uint32_t start;
+	uint16_t stride;
+	uint16_t count;
+} bulk_span_t;
+
+
+/** Read the bytes described by the spans, in one session on the
+ * device, into out in the same order.  The batch command must
+ * already have been sent.
+ * \param size Set to the image size once the device announces it.
+ * \return 0 on success, or -1 on error, including an address past
+ * the end of the image.
+ */
+extern int
+bulk_batch(
+	int fd,
+	const bulk_span_t * spans,
+	size_t count,
+	uint8_t * out,
+	uint32_t * size,
+	int timeout_ms
+);
+
+#endif
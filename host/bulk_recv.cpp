@@ -0,0 +1,222 @@
+/** \file Host side of the windowed bulk dump protocol.
+ *
+ * Frames are parsed out of the serial stream, so any text the
+ * device prints around the transfer (command echo, prompts) is
+ * skipped along with corrupted frames.
+ */
+#include <string.h>
+#include <vector>
+#include "serial.h"
+#include "bulk_recv.h"
+#include "../promdate/bulk.h"
+#include "../promdate/crc32.h"
+#include "../promdate/packbits.h"
+
+/** How long to wait for data before nudging the device */
+#define BULK_POLL_MS 100
+
+
+int
+bulk_write(
+	const int fd,
+	const uint8_t type,
+	const uint32_t seq,
+	const uint8_t * const payload,
+	const uint16_t len
+)
+{
+	uint8_t frame[BULK_HEADER + BULK_PAYLOAD + BULK_TRAILER];
+	if (len > BULK_PAYLOAD)
+		return -1;
+
+	frame[0] = BULK_MAGIC;
+	frame[1] = type;
+	bulk_put16(&frame[2], len);
+	bulk_put32(&frame[4], seq);
+	if (len)
+		memcpy(&frame[BULK_HEADER], payload, len);
+	bulk_put32(&frame[BULK_HEADER + len], crc32_update(0, frame, BULK_HEADER + len));
+
+	return serial_write(fd, frame, BULK_HEADER + len + BULK_TRAILER);
+}
+
+
+const uint8_t *
+bulk_parse(
+	const uint8_t * const buf,
+	const size_t size,
+	size_t * const off
+)
+{
+	while (1)
+	{
+		// Resync on the magic number
+		while (*off < size && buf[*off] != BULK_MAGIC)
+			(*off)++;
+		if (size - *off < BULK_HEADER)
+			return NULL;
+
+		const uint8_t * const f = &buf[*off];
+		const uint16_t len = bulk_get16(&f[2]);
+		if (len > BULK_PAYLOAD)
+		{
+			(*off)++;
+			continue;
+		}
+		if (size - *off < (size_t) BULK_HEADER + len + BULK_TRAILER)
+			return NULL;
+
+		const uint32_t crc = crc32_update(0, f, BULK_HEADER + len);
+		if (crc != bulk_get32(&f[BULK_HEADER + len]))
+		{
+			(*off)++;
+			continue;
+		}
+
+		*off += BULK_HEADER + len + BULK_TRAILER;
+		return f;
+	}
+}
+
+
+static int
+bulk_reply(
+	const int fd,
+	const uint8_t type,
+	const uint32_t seq
+)
+{
+	return bulk_write(fd, type, seq, NULL, 0);
+}
+
+
+int64_t
+bulk_recv(
+	const int fd,
+	const bulk_recv_t * const recv
+)
+{
+	std::vector<uint8_t> rx;
+	std::vector<uint8_t> have;
+	uint8_t * image = NULL;
+	uint32_t size = 0;
+	uint32_t frame_size = BULK_PAYLOAD;
+	uint32_t frames = 0;
+	uint32_t expected = 0;
+	uint32_t naks = 0;
+	int64_t last_nak = -1;
+	int idle = 0;
+
+	while (1)
+	{
+		uint8_t buf[4096];
+		const ssize_t n = serial_read(fd, buf, sizeof(buf), BULK_POLL_MS);
+		if (n < 0)
+			return -1;
+
+		if (n == 0)
+		{
+			idle += BULK_POLL_MS;
+			if (idle >= recv->timeout_ms)
+				return -1;
+
+			// Nudge the device if a frame has gone missing
+			if (image && bulk_reply(fd, BULK_NAK, expected) < 0)
+				return -1;
+			continue;
+		}
+
+		idle = 0;
+		rx.insert(rx.end(), buf, buf + n);
+
+		size_t off = 0;
+		const uint8_t * f;
+		while ((f = bulk_parse(rx.data(), rx.size(), &off)) != NULL)
+		{
+			const uint8_t type = f[1];
+			const uint16_t len = bulk_get16(&f[2]);
+			const uint32_t seq = bulk_get32(&f[4]);
+			const uint8_t * const payload = &f[BULK_HEADER];
+
+			if (type == BULK_START && len >= 6)
+			{
+				if (!image)
+				{
+					size = bulk_get32(&payload[0]);
+					frame_size = bulk_get16(&payload[4]);
+					const uint32_t offset = len >= 10 ? bulk_get32(&payload[6]) : 0;
+					if (frame_size == 0 || frame_size > BULK_PAYLOAD)
+						return -1;
+					frames = (size + frame_size - 1) / frame_size;
+					have.assign(frames, 0);
+
+					image = recv->start(recv->priv, offset, size);
+					if (!image)
+					{
+						bulk_reply(fd, BULK_CAN, 0);
+						return -1;
+					}
+				}
+
+				if (bulk_reply(fd, BULK_ACK, 0) < 0)
+					return -1;
+			} else
+			if ((type == BULK_DATA || type == BULK_PACKED) && image)
+			{
+				if (seq < frames && !have[seq])
+				{
+					const uint64_t pos = (uint64_t) seq * frame_size;
+					const uint32_t frame_len = size - pos < frame_size ? size - pos : frame_size;
+
+					// A short frame would leave stale bytes
+					// in a frame marked as received.
+					if (type == BULK_DATA && len == frame_len)
+					{
+						memcpy(image + pos, payload, len);
+						have[seq] = 1;
+					} else
+					if (type == BULK_PACKED
+					&& packbits_decode(image + pos, frame_len, payload, len) == (int32_t) frame_len)
+						have[seq] = 1;
+				}
+
+				while (expected < frames && have[expected])
+					expected++;
+
+				if (bulk_reply(fd, BULK_ACK, expected) < 0)
+					return -1;
+
+				// A later frame arrived first; ask for the gap once
+				if (seq > expected && last_nak != expected)
+				{
+					last_nak = expected;
+					naks++;
+					if (bulk_reply(fd, BULK_NAK, expected) < 0)
+						return -1;
+				}
+
+				if (recv->progress)
+				{
+					uint64_t done = (uint64_t) expected * frame_size;
+					if (done > size)
+						done = size;
+					recv->progress(recv->priv, done, size, naks);
+				}
+			} else
+			if (type == BULK_END && image)
+			{
+				if (expected == frames)
+				{
+					if (bulk_reply(fd, BULK_ACK, frames) < 0)
+						return -1;
+					return size;
+				}
+
+				if (bulk_reply(fd, BULK_NAK, expected) < 0)
+					return -1;
+			}
+		}
+
+		rx.erase(rx.begin(), rx.begin() + off);
+	}
+}
@@ -0,0 +1,66 @@
+/** \file
+ * Host side of the windowed bulk dump protocol described in
+ * promdate/bulk.h.
+ */
+#ifndef _host_bulk_recv_h_
+#define _host_bulk_recv_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct
+{
+	/** Called when the device announces the offset and size of
+	 * the image, or of the part of it in a ranged dump.
+	 * Returns the buffer to receive it, or NULL to cancel.
+	 */
+	uint8_t * (*start)(void * priv, uint32_t offset, uint32_t size);
+
+	/** Called as frames arrive, with the number of bytes that
+	 * are complete from the start of the transfer.  May be NULL.
+	 */
+	void (*progress)(void * priv, uint32_t done, uint32_t size, uint32_t naks);
+
+	void * priv;
+
+	/** Give up if the device is silent for this long */
+	int timeout_ms;
+} bulk_recv_t;
+
+
+/** Send a frame with len bytes of payload.
+ * \return 0 on success, -1 on error.
+ */
+extern int
+bulk_write(
+	int fd,
+	uint8_t type,
+	uint32_t seq,
+	const uint8_t * payload,
+	uint16_t len
+);
+
+
+/** Find the next valid frame in buf starting at *off, skipping
+ * any text and corrupted frames.  *off is moved past the frame.
+ * \return the frame, or NULL if more bytes are needed.
+ */
+extern const uint8_t *
+bulk_parse(
+	const uint8_t * buf,
+	size_t size,
+	size_t * off
+);
+
+
+/** Receive an image from the device.
+ * The dump command must already have been sent.
+ * \return the image size, or -1 on error or cancel.
+ */
+extern int64_t
+bulk_recv(
+	int fd,
+	const bulk_recv_t * recv
+);
+
+#endif
@@ -0,0 +1,155 @@
+/** \file Host side of the bulk verify and batch read requests.
+ *
+ * The device answers every request on its own, so the host keeps
+ * track of which ones are still unanswered and resends them all
+ * if the device goes quiet.  A late duplicate answer is ignored.
+ */
+#include <vector>
+#include "serial.h"
+#include "bulk_recv.h"
+#include "bulk_request.h"
+#include "../promdate/bulk.h"
+
+
+/** Build and send one request */
+static int
+request_send(
+	const int fd,
+	const bulk_request_t * const req,
+	const uint32_t seq
+)
+{
+	uint8_t payload[BULK_PAYLOAD];
+	const uint16_t len = req->request(req->priv, seq, payload);
+	return bulk_write(fd, req->type, seq, payload, len);
+}
+
+
+int
+bulk_request(
+	const int fd,
+	const bulk_request_t * const req
+)
+{
+	std::vector<uint8_t> rx;
+	std::vector<uint8_t> answered;
+	int started = 0;
+	int ending = 0;
+	uint32_t requests = 0;
+	uint32_t base = 0; // oldest unanswered request
+	uint32_t next = 0; // next new request to send
+	uint32_t resent = 0;
+	int idle = 0;
+
+	while (1)
+	{
+		// Keep the window full
+		while (started && next < requests && next - base < BULK_WINDOW)
+			if (request_send(fd, req, next++) < 0)
+				return -1;
+
+		uint8_t buf[4096];
+		const ssize_t n = serial_read(fd, buf, sizeof(buf), BULK_TIMEOUT_MS);
+		if (n < 0)
+			return -1;
+
+		if (n == 0)
+		{
+			idle += BULK_TIMEOUT_MS;
+			if (idle >= req->timeout_ms)
+				return -1;
+			if (!started)
+				continue;
+
+			// Requests or their answers were lost
+			if (ending)
+			{
+				if (bulk_write(fd, BULK_END, requests, NULL, 0) < 0)
+					return -1;
+				continue;
+			}
+
+			for (uint32_t seq = base ; seq < next ; seq++)
+			{
+				if (answered[seq])
+					continue;
+				if (request_send(fd, req, seq) < 0)
+					return -1;
+				resent++;
+			}
+			continue;
+		}
+
+		idle = 0;
+		rx.insert(rx.end(), buf, buf + n);
+
+		size_t off = 0;
+		const uint8_t * f;
+		while ((f = bulk_parse(rx.data(), rx.size(), &off)) != NULL)
+		{
+			const uint8_t type = f[1];
+			const uint16_t len = bulk_get16(&f[2]);
+			const uint32_t seq = bulk_get32(&f[4]);
+			const uint8_t * const payload = &f[BULK_HEADER];
+
+			if (type == BULK_START && len >= 6)
+			{
+				if (!started)
+				{
+					const uint32_t size = bulk_get32(&payload[0]);
+					const uint32_t frame_size = bulk_get16(&payload[4]);
+					if (frame_size == 0 || frame_size > BULK_PAYLOAD)
+						return -1;
+
+					const int64_t count = req->start(req->priv, size, frame_size);
+					if (count < 0)
+					{
+						bulk_write(fd, BULK_CAN, 0, NULL, 0);
+						return -1;
+					}
+
+					requests = count;
+					answered.assign(requests, 0);
+					started = 1;
+				}
+
+				if (bulk_write(fd, BULK_ACK, 0, NULL, 0) < 0)
+					return -1;
+			} else
+			if (type == BULK_END && ending && seq == requests)
+			{
+				if (bulk_write(fd, BULK_ACK, requests, NULL, 0) < 0)
+					return -1;
+				return 0;
+			} else
+			if (type != BULK_START && type != BULK_END
+			&& started && seq < requests && !answered[seq])
+			{
+				const int rc = req->answer(req->priv, seq, type, payload, len);
+				if (rc < 0)
+				{
+					bulk_write(fd, BULK_CAN, 0, NULL, 0);
+					return -1;
+				}
+				if (rc == 0)
+					continue;
+
+				answered[seq] = 1;
+				while (base < requests && answered[base])
+					base++;
+
+				if (req->progress)
+					req->progress(req->priv, base, requests, resent);
+			}
+
+			if (started && !ending && base == requests)
+			{
+				ending = 1;
+				if (bulk_write(fd, BULK_END, requests, NULL, 0) < 0)
+					return -1;
+			}
+		}
+
+		rx.erase(rx.begin(), rx.begin() + off);
+	}
+}
@@ -0,0 +1,56 @@
+/** \file
+ * Host side of the bulk protocol requests that the device answers
+ * one frame at a time, verify and batch read, described in
+ * promdate/bulk.h.
+ */
+#ifndef _host_bulk_request_h_
+#define _host_bulk_request_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct
+{
+	/** Frame type of the requests */
+	uint8_t type;
+
+	/** Called when the device announces the image size and its
+	 * largest frame payload.
+	 * Returns the number of requests to send, or -1 to cancel.
+	 */
+	int64_t (*start)(void * priv, uint32_t size, uint32_t frame_size);
+
+	/** Build request seq into payload.
+	 * Returns the payload length.
+	 */
+	uint16_t (*request)(void * priv, uint32_t seq, uint8_t * payload);
+
+	/** Called with the first answer to each request.
+	 * Returns 1 if it is accepted, 0 if it is malformed and the
+	 * request should be resent, or -1 to abort.
+	 */
+	int (*answer)(void * priv, uint32_t seq, uint8_t type, const uint8_t * payload, uint16_t len);
+
+	/** Called as requests are answered, with the number that are
+	 * complete from the first one.  May be NULL.
+	 */
+	void (*progress)(void * priv, uint32_t done, uint32_t requests, uint32_t resent);
+
+	void * priv;
+
+	/** Give up if the device is silent for this long */
+	int timeout_ms;
+} bulk_request_t;
+
+
+/** Send the requests to the device and collect the answers.
+ * The command must already have been sent.
+ * \return 0 on success, or -1 on error or cancel.
+ */
+extern int
+bulk_request(
+	int fd,
+	const bulk_request_t * req
+);
+
+#endif
@@ -0,0 +1,166 @@
+/** \file Host side of the bulk verify protocol.
+ *
+ * The expected image is sent as BULK_DATA requests, and each answer
+ * is an ACK, difference records, or the frame as read from the chip.
+ */
+#include <string.h>
+#include "bulk_request.h"
+#include "bulk_verify.h"
+#include "../promdate/bulk.h"
+
+
+typedef struct
+{
+	const bulk_verify_t * verify;
+	const uint8_t * image;
+	size_t image_size;
+
+	/** Bytes being compared, the smaller of the image and chip */
+	uint32_t size;
+	uint32_t frame_size;
+	int64_t differ;
+} verify_state_t;
+
+
+/** Length of the image in one frame */
+static uint32_t
+verify_frame_len(
+	const verify_state_t * const v,
+	const uint32_t seq
+)
+{
+	const uint32_t pos = seq * v->frame_size;
+	return v->size - pos < v->frame_size ? v->size - pos : v->frame_size;
+}
+
+
+static int64_t
+verify_start(
+	void * const priv,
+	const uint32_t size,
+	const uint32_t frame_size
+)
+{
+	verify_state_t * const v = (verify_state_t *) priv;
+	if (v->verify->start(v->verify->priv, size) < 0)
+		return -1;
+
+	v->size = v->image_size < size ? v->image_size : size;
+	v->frame_size = frame_size;
+	return (v->size + frame_size - 1) / frame_size;
+}
+
+
+static uint16_t
+verify_request(
+	void * const priv,
+	const uint32_t seq,
+	uint8_t * const payload
+)
+{
+	verify_state_t * const v = (verify_state_t *) priv;
+	const uint32_t len = verify_frame_len(v, seq);
+	memcpy(payload, v->image + seq * v->frame_size, len);
+	return len;
+}
+
+
+static int
+verify_answer(
+	void * const priv,
+	const uint32_t seq,
+	const uint8_t type,
+	const uint8_t * const payload,
+	const uint16_t len
+)
+{
+	verify_state_t * const v = (verify_state_t *) priv;
+	const bulk_verify_t * const verify = v->verify;
+	const uint32_t pos = seq * v->frame_size;
+	const uint32_t frame_len = verify_frame_len(v, seq);
+	const uint8_t * const expected = v->image + pos;
+
+	if (type == BULK_ACK)
+		return 1;
+
+	if (type == BULK_DIFF)
+	{
+		if (len % BULK_DIFF_RECORD != 0)
+			return 0;
+		for (uint16_t i = 0 ; i < len ; i += BULK_DIFF_RECORD)
+			if (payload[i] >= frame_len)
+				return 0;
+
+		for (uint16_t i = 0 ; i < len ; i += BULK_DIFF_RECORD)
+		{
+			const uint8_t * const r = &payload[i];
+			verify->diff(verify->priv, pos + r[0], r[1], r[2]);
+			v->differ++;
+		}
+		return 1;
+	}
+
+	if (type == BULK_READ)
+	{
+		if (len != frame_len)
+			return 0;
+		for (uint32_t i = 0 ; i < len ; i++)
+		{
+			if (payload[i] == expected[i])
+				continue;
+			verify->diff(verify->priv, pos + i, expected[i], payload[i]);
+			v->differ++;
+		}
+		return 1;
+	}
+
+	// A NAK, or anything else, will not get any better
+	return -1;
+}
+
+
+static void
+verify_progress(
+	void * const priv,
+	const uint32_t done,
+	const uint32_t requests,
+	const uint32_t resent
+)
+{
+	verify_state_t * const v = (verify_state_t *) priv;
+	if (!v->verify->progress)
+		return;
+
+	const uint32_t bytes = done < requests ? done * v->frame_size : v->size;
+	v->verify->progress(v->verify->priv, bytes, v->size, resent);
+}
+
+
+int64_t
+bulk_verify(
+	const int fd,
+	const uint8_t * const image,
+	const size_t image_size,
+	const bulk_verify_t * const verify
+)
+{
+	verify_state_t v;
+	memset(&v, 0, sizeof(v));
+	v.verify = verify;
+	v.image = image;
+	v.image_size = image_size;
+
+	const bulk_request_t req = {
+		BULK_DATA,
+		verify_start,
+		verify_request,
+		verify_answer,
+		verify_progress,
+		&v,
+		verify->timeout_ms,
+	};
+
+	if (bulk_request(fd, &req) < 0)
+		return -1;
+	return v.differ;
+}
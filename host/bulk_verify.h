@@ -0,0 +1,45 @@
+/** \file
+ * Host side of the bulk verify protocol described in promdate/bulk.h.
+ */
+#ifndef _host_bulk_verify_h_
+#define _host_bulk_verify_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct
+{
+	/** Called when the device announces the chip size.
+	 * Returns 0 to continue, or -1 to cancel.
+	 */
+	int (*start)(void * priv, uint32_t size);
+
+	/** Called for each byte that differs from the image */
+	void (*diff)(void * priv, uint32_t addr, uint8_t expected, uint8_t actual);
+
+	/** Called as frames are answered, with the number of bytes that
+	 * are checked from the start of the image.  May be NULL.
+	 */
+	void (*progress)(void * priv, uint32_t done, uint32_t size, uint32_t resent);
+
+	void * priv;
+
+	/** Give up if the device is silent for this long */
+	int timeout_ms;
+} bulk_verify_t;
+
+
+/** Stream the expected image to the device and collect the bytes
+ * that differ.  Only as much of the image as fits in the chip is
+ * compared.  The verify command must already have been sent.
+ * \return the number of bytes that differ, or -1 on error or cancel.
+ */
+extern int64_t
+bulk_verify(
+	int fd,
+	const uint8_t * image,
+	size_t image_size,
+	const bulk_verify_t * verify
+);
+
+#endif
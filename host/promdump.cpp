@@ -0,0 +1,761 @@
+/** \file
+ * Dump a chip from the PROMdate with the windowed bulk protocol.
+ *
+ * Usage: promdump [-cqrz] [-m CHIP] /dev/ttyACM0 out.bin
+ *        promdump [-qz] [-m CHIP] -v golden.bin /dev/ttyACM0
+ *        promdump [-qz] [-m CHIP] -a LIST /dev/ttyACM0
+ *
+ * The image is received straight into a memory mapped output file.
+ * If the output is "-" the image is written to stdout as soon as
+ * each part of it is complete, so that post-processing can start
+ * before the dump finishes.
+ *
+ * A transfer that fails part way is resumed from the last frame
+ * that arrived in order, with a ranged dump of the rest, up to
+ * DUMP_ATTEMPTS times.  Progress is also saved to out.bin.resume,
+ * so that -r can continue a dump that was interrupted or gave up.
+ *
+ * With -c the device PackBits compresses each frame when that makes
+ * it shorter, which makes erased and sparse chips much quicker.
+ *
+ * With -v the chip is instead compared against golden.bin on the
+ * device, which sends back only the bytes that differ.  They are
+ * listed on stdout and the exit status is non-zero if there are any,
+ * or if golden.bin is not the same size as the chip.
+ *
+ * With -a only the bytes at a list of addresses are read, all in
+ * one session on the device, and listed on stdout.
+ *
+ * The device can also be a pty connected to a simulated PROMdate.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "serial.h"
+#include "bulk_recv.h"
+#include "bulk_verify.h"
+#include "bulk_batch.h"
+#include "../promdate/bulk.h"
+
+/** How often to update the progress line and resume state */
+#define PROGRESS_MS 200
+
+/** Transfers to try before giving up on a dump */
+#define DUMP_ATTEMPTS 5
+
+
+typedef struct
+{
+	const char * path;
+	int fd;
+	uint8_t * image;
+	uint32_t size;
+
+	/** Start of the current transfer, non-zero when resuming */
+	uint32_t offset;
+
+	/** Bytes complete from the start of the image */
+	uint32_t done;
+
+	/** Bytes that were already complete when this run started */
+	uint32_t done_before;
+
+	/** Bytes already written to stdout when streaming */
+	uint32_t written;
+
+	/** Expected image for a verify */
+	const char * golden;
+	size_t golden_size;
+
+	int quiet;
+	double start;
+	double last_report;
+	double last_state;
+} dump_t;
+
+
+/** Where the progress of a dump is saved, out.bin.resume */
+static std::string state_path;
+
+
+static double
+now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/** Save how much of the image is complete, for -r */
+static void
+dump_save_state(
+	const dump_t * const d
+)
+{
+	if (d->fd < 0)
+		return;
+
+	FILE * const f = fopen(state_path.c_str(), "w");
+	if (!f)
+		return;
+	fprintf(f, "%u %u\n", d->done, d->size);
+	fclose(f);
+}
+
+
+/** Load the progress of an earlier dump of the same output.
+ * \return 0 on success, -1 if there is none.
+ */
+static int
+dump_load_state(
+	dump_t * const d
+)
+{
+	FILE * const f = fopen(state_path.c_str(), "r");
+	if (!f)
+		return -1;
+
+	unsigned done, size;
+	const int rc = fscanf(f, "%u %u", &done, &size);
+	fclose(f);
+	if (rc != 2 || done > size)
+		return -1;
+
+	d->done = done;
+	d->size = size;
+	return 0;
+}
+
+
+/** Size the output for the whole image and map it */
+static uint8_t *
+dump_map(
+	dump_t * const d
+)
+{
+	const uint32_t size = d->size;
+
+	if (d->fd < 0)
+		return (uint8_t *) malloc(size ? size : 1);
+
+	if (ftruncate(d->fd, size) < 0)
+	{
+		fprintf(stderr, "%s: %s\n", d->path, strerror(errno));
+		return NULL;
+	}
+
+	void * const map = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: %s\n", d->path, strerror(errno));
+		return NULL;
+	}
+
+	return (uint8_t *) map;
+}
+
+
+/** bulk_recv_t start callback: map the output on the first transfer,
+ * and check that a ranged one continues where the last one stopped.
+ */
+static uint8_t *
+dump_start(
+	void * const priv,
+	const uint32_t offset,
+	const uint32_t size
+)
+{
+	dump_t * const d = (dump_t *) priv;
+
+	if (!d->image)
+	{
+		if (d->size == 0)
+			d->size = offset + size;
+		d->start = now();
+		d->done_before = d->done;
+		d->image = dump_map(d);
+		if (!d->image)
+			return NULL;
+	}
+
+	if (offset > d->done || offset + size != d->size)
+	{
+		fprintf(stderr, "%s: device sent %u bytes at %u, expected the rest of %u from %u\n",
+			d->path, size, offset, d->size, d->done);
+		return NULL;
+	}
+
+	d->offset = offset;
+	return d->image + offset;
+}
+
+
+/** Report throughput and ETA, at most every PROGRESS_MS */
+static void
+dump_report(
+	dump_t * const d,
+	const uint32_t done,
+	const uint32_t size,
+	const uint32_t retries
+)
+{
+	const double t = now();
+	if (d->quiet || (done != size && t - d->last_report < PROGRESS_MS / 1000.0))
+		return;
+	d->last_report = t;
+
+	const double elapsed = t - d->start;
+	const double rate = elapsed > 0 ? (done - d->done_before) / elapsed : 0;
+	const double eta = rate > 0 ? (size - done) / rate : 0;
+
+	fprintf(stderr, "\r%u/%u bytes %.1f KB/s ETA %.0fs retries %u ",
+		done, size, rate / 1024, eta, retries);
+	if (done == size)
+		fprintf(stderr, "\n");
+}
+
+
+/** bulk_recv_t progress callback: stream and report throughput */
+static void
+dump_progress(
+	void * const priv,
+	const uint32_t done,
+	const uint32_t size,
+	const uint32_t naks
+)
+{
+	(void) size;
+	dump_t * const d = (dump_t *) priv;
+	if (d->offset + done > d->done)
+		d->done = d->offset + done;
+
+	if (d->fd < 0 && d->done > d->written)
+	{
+		if (fwrite(d->image + d->written, 1, d->done - d->written, stdout) != d->done - d->written)
+			exit(EXIT_FAILURE);
+		fflush(stdout);
+		d->written = d->done;
+	}
+
+	const double t = now();
+	if (t - d->last_state >= PROGRESS_MS / 1000.0)
+	{
+		d->last_state = t;
+		dump_save_state(d);
+	}
+
+	dump_report(d, d->done, d->size, naks);
+}
+
+
+/** Differences found by a verify, as address << 16 | expected << 8 | actual */
+static std::vector<uint64_t> diffs;
+
+
+/** bulk_verify_t start callback: check the sizes agree */
+static int
+verify_start(
+	void * const priv,
+	const uint32_t size
+)
+{
+	dump_t * const d = (dump_t *) priv;
+	d->size = size;
+	d->start = now();
+
+	if (d->golden_size != size)
+		fprintf(stderr, "%s: %zu bytes, but the chip has %u; comparing the first %zu\n",
+			d->golden,
+			d->golden_size,
+			size,
+			d->golden_size < size ? d->golden_size : (size_t) size
+		);
+
+	return 0;
+}
+
+
+/** bulk_verify_t diff callback */
+static void
+verify_diff(
+	void * const priv,
+	const uint32_t addr,
+	const uint8_t expected,
+	const uint8_t actual
+)
+{
+	(void) priv;
+	diffs.push_back((uint64_t) addr << 16 | expected << 8 | actual);
+}
+
+
+/** bulk_verify_t progress callback */
+static void
+verify_progress(
+	void * const priv,
+	const uint32_t done,
+	const uint32_t size,
+	const uint32_t resent
+)
+{
+	dump_report((dump_t *) priv, done, size, resent);
+}
+
+
+/** Read the expected image for a verify.
+ * \return 0 on success, -1 if the file could not be read.
+ */
+static int
+verify_load(
+	dump_t * const d,
+	std::vector<uint8_t> & image
+)
+{
+	FILE * const f = fopen(d->golden, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "%s: %s\n", d->golden, strerror(errno));
+		return -1;
+	}
+
+	fseek(f, 0, SEEK_END);
+	d->golden_size = ftell(f);
+	rewind(f);
+
+	image.resize(d->golden_size);
+	if (fread(image.data(), 1, d->golden_size, f) != d->golden_size)
+	{
+		fprintf(stderr, "%s: short read\n", d->golden);
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+/** Collects the device's text output between prompts */
+static std::string reply;
+
+static void
+reply_output(
+	const char * const buf,
+	const size_t len
+)
+{
+	reply.append(buf, len);
+}
+
+
+/** Run a command and wait for the next prompt.
+ * \return 0 on success, -1 on timeout.
+ */
+static int
+command(
+	const int fd,
+	const char * const cmd
+)
+{
+	reply.clear();
+	if (serial_command(fd, cmd) < 0)
+		return -1;
+	return serial_prompt(fd, 5000, reply_output);
+}
+
+
+/** Pass on the device's resend and read stability report */
+static void
+device_report(
+	const int fd,
+	const dump_t * const d
+)
+{
+	reply.clear();
+	serial_prompt(fd, 5000, reply_output);
+	if (d->quiet)
+		return;
+
+	const size_t start = reply.find_first_not_of("\r\n");
+	if (start != std::string::npos)
+		fprintf(stderr, "%s", reply.c_str() + start);
+}
+
+
+/** Stop a transfer that is still running on the device and get
+ * back to a prompt.
+ * \return 0 on success, -1 if the device does not respond.
+ */
+static int
+dump_resync(
+	const int fd
+)
+{
+	if (bulk_write(fd, BULK_CAN, 0, NULL, 0) < 0)
+		return -1;
+
+	char junk[64];
+	while (serial_read(fd, junk, sizeof(junk), 300) > 0)
+		;
+
+	return command(fd, "");
+}
+
+
+/** Parse a list of addresses, "ADDR" or "START+STRIDE*COUNT" separated
+ * by commas, in C notation so 0x for hex.
+ * \return 0 on success, -1 on a syntax error.
+ */
+static int
+batch_parse(
+	const char * p,
+	std::vector<bulk_span_t> & spans
+)
+{
+	while (1)
+	{
+		char * end;
+		bulk_span_t s = { 0, 0, 1 };
+
+		s.start = strtoul(p, &end, 0);
+		if (end == p)
+			return -1;
+		p = end;
+
+		if (*p == '+')
+		{
+			s.stride = strtoul(p + 1, &end, 0);
+			if (end == p + 1 || *end != '*')
+				return -1;
+			p = end + 1;
+
+			const unsigned long count = strtoul(p, &end, 0);
+			if (end == p || count > 0xFFFF)
+				return -1;
+			s.count = count;
+			p = end;
+		}
+
+		spans.push_back(s);
+		if (*p == '\0')
+			return 0;
+		if (*p++ != ',')
+			return -1;
+	}
+}
+
+
+/** Read the bytes at the listed addresses and print them */
+static int
+batch(
+	const int fd,
+	const char * const dev,
+	const dump_t * const d,
+	const std::vector<bulk_span_t> & spans
+)
+{
+	size_t total = 0;
+	for (size_t i = 0 ; i < spans.size() ; i++)
+		total += spans[i].count;
+	std::vector<uint8_t> out(total);
+
+	serial_command(fd, "a");
+	uint32_t size;
+	if (bulk_batch(fd, spans.data(), spans.size(), out.data(), &size, 5000) < 0)
+	{
+		if (size)
+			fprintf(stderr, "%s: batch read failed, is every address below %#x?\n", dev, size);
+		else
+			fprintf(stderr, "%s: batch read failed\n", dev);
+		return EXIT_FAILURE;
+	}
+
+	device_report(fd, d);
+
+	size_t n = 0;
+	for (size_t i = 0 ; i < spans.size() ; i++)
+		for (uint32_t j = 0 ; j < spans[i].count ; j++)
+			printf("%06x: %02x\n", spans[i].start + j * spans[i].stride, out[n++]);
+
+	close(fd);
+	return EXIT_SUCCESS;
+}
+
+
+/** Compare the chip against the golden image and list differences */
+static int
+verify(
+	const int fd,
+	const char * const dev,
+	dump_t * const d,
+	const std::vector<uint8_t> & golden
+)
+{
+	bulk_verify_t v = {
+		verify_start,
+		verify_diff,
+		verify_progress,
+		d,
+		5000,
+	};
+
+	serial_command(fd, "v");
+	const int64_t differ = bulk_verify(fd, golden.data(), d->golden_size, &v);
+	if (differ < 0)
+	{
+		fprintf(stderr, "%s: verify failed\n", dev);
+		return EXIT_FAILURE;
+	}
+
+	device_report(fd, d);
+
+	// Frames may be answered out of order
+	std::sort(diffs.begin(), diffs.end());
+	for (size_t i = 0 ; i < diffs.size() ; i++)
+		printf("%06x: expected %02x read %02x\n",
+			(unsigned) (diffs[i] >> 16),
+			(unsigned) (diffs[i] >> 8) & 0xFF,
+			(unsigned) diffs[i] & 0xFF
+		);
+
+	if (!d->quiet)
+		fprintf(stderr, "%s: %lld bytes differ\n", d->golden, (long long) differ);
+
+	close(fd);
+
+	// Only the common part was compared, so the image does not match
+	if (d->golden_size != d->size)
+		return EXIT_FAILURE;
+
+	return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+static void
+usage(
+	const char * const prog
+)
+{
+	fprintf(stderr,
+"Usage: %s [options] /dev/ttyACM0 out.bin\n"
+"       %s [options] -v golden.bin /dev/ttyACM0\n"
+"       %s [options] -a LIST /dev/ttyACM0\n"
+"\n"
+"Options:\n"
+"    -a | --addrs LIST    Read only the bytes at LIST instead of dumping:\n"
+"                         ADDR or START+STRIDE*COUNT, separated by commas\n"
+"    -c | --compress      Compress the frames, for sparse or erased chips\n"
+"    -m | --chip NAME     Select the chip type before dumping\n"
+"    -q | --quiet         No progress output\n"
+"    -r | --resume        Continue an earlier dump into out.bin\n"
+"    -v | --verify FILE   Compare the chip against FILE instead of dumping\n"
+"                         and list the bytes that differ\n"
+"    -z | --probe         Probe for mirrored address lines first and\n"
+"                         dump only the populated capacity\n"
+"\n"
+"Use - as the output to stream the image to stdout.\n",
+		prog,
+		prog,
+		prog
+	);
+	exit(EXIT_FAILURE);
+}
+
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	static const struct option options[] = {
+		{ "addrs", required_argument, NULL, 'a' },
+		{ "compress", no_argument, NULL, 'c' },
+		{ "chip", required_argument, NULL, 'm' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "resume", no_argument, NULL, 'r' },
+		{ "verify", required_argument, NULL, 'v' },
+		{ "probe", no_argument, NULL, 'z' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	const char * chip = NULL;
+	int probe = 0;
+	int compress = 0;
+	int resume = 0;
+	const char * addrs = NULL;
+	std::vector<bulk_span_t> spans;
+	dump_t d;
+	memset(&d, 0, sizeof(d));
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "a:cm:qrv:z", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'a':
+			addrs = optarg;
+			if (batch_parse(addrs, spans) < 0)
+			{
+				fprintf(stderr, "%s: bad address list\n", addrs);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c': compress = 1; break;
+		case 'm': chip = optarg; break;
+		case 'q': d.quiet = 1; break;
+		case 'r': resume = 1; break;
+		case 'v': d.golden = optarg; break;
+		case 'z': probe = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	const int no_output = d.golden || addrs;
+	if (argc - optind != (no_output ? 1 : 2))
+		usage(argv[0]);
+
+	const char * const dev = argv[optind+0];
+	d.path = no_output ? "-" : argv[optind+1];
+	state_path = std::string(d.path) + ".resume";
+
+	if (resume && strcmp(d.path, "-") == 0)
+	{
+		fprintf(stderr, "-r needs an output file\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint8_t> golden;
+	if (d.golden && verify_load(&d, golden) < 0)
+		return EXIT_FAILURE;
+
+	const int fd = serial_open(dev);
+	if (fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", dev, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	d.fd = -1;
+	if (strcmp(d.path, "-") != 0)
+	{
+		d.fd = open(d.path, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0666);
+		if (d.fd < 0)
+		{
+			fprintf(stderr, "%s: %s\n", d.path, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (resume && dump_load_state(&d) < 0)
+	{
+		fprintf(stderr, "%s: nothing to resume\n", state_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	// Discard anything already waiting, such as the prompt from when
+	// the device started, so that replies line up with commands.
+	char junk[64];
+	while (serial_read(fd, junk, sizeof(junk), 100) > 0)
+		;
+
+	// Get back to a prompt in case a previous command was half typed
+	if (command(fd, "") < 0)
+	{
+		fprintf(stderr, "%s: no prompt from device\n", dev);
+		return EXIT_FAILURE;
+	}
+
+	if (chip)
+	{
+		const std::string cmd = std::string("m") + chip;
+		if (command(fd, cmd.c_str()) < 0
+		||  reply.find("No such chip") != std::string::npos)
+		{
+			fprintf(stderr, "%s: unknown chip '%s'\n", dev, chip);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Dump only the populated part of a small chip in a large footprint
+	if (probe)
+	{
+		if (command(fd, "z") < 0
+		||  reply.find("Capacity") == std::string::npos)
+		{
+			fprintf(stderr, "%s: capacity probe failed\n", dev);
+			return EXIT_FAILURE;
+		}
+		if (!d.quiet)
+			fprintf(stderr, "%s", reply.c_str() + reply.find("Capacity"));
+	}
+
+	if (d.golden)
+		return verify(fd, dev, &d, golden);
+	if (addrs)
+		return batch(fd, dev, &d, spans);
+
+	bulk_recv_t recv = {
+		dump_start,
+		dump_progress,
+		&d,
+		5000,
+	};
+
+	for (int attempt = 1 ; ; attempt++)
+	{
+		// Start from the first byte that is not already complete
+		char cmd[32];
+		if (d.done == 0)
+			snprintf(cmd, sizeof(cmd), "%s", compress ? "bz" : "b");
+		else
+			snprintf(cmd, sizeof(cmd), "%s %x %x", compress ? "bz" : "b", d.done, d.size - d.done);
+
+		serial_command(fd, cmd);
+		if (bulk_recv(fd, &recv) >= 0)
+			break;
+
+		dump_save_state(&d);
+		if (attempt == DUMP_ATTEMPTS || dump_resync(fd) < 0)
+		{
+			fprintf(stderr, "\n%s: transfer failed at %u of %u bytes\n", dev, d.done, d.size);
+			if (d.fd >= 0 && d.image)
+				fprintf(stderr, "%s: run again with -r to resume\n", d.path);
+			return EXIT_FAILURE;
+		}
+
+		if (!d.quiet)
+			fprintf(stderr, "\n%s: transfer failed at %u bytes, resuming\n", dev, d.done);
+	}
+
+	device_report(fd, &d);
+	const uint32_t size = d.size;
+
+	if (d.fd >= 0)
+	{
+		unlink(state_path.c_str());
+
+		if (msync(d.image, size ? size : 1, MS_SYNC) < 0
+		||  munmap(d.image, size ? size : 1) < 0
+		||  close(d.fd) < 0)
+		{
+			fprintf(stderr, "%s: %s\n", d.path, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	} else {
+		free(d.image);
+	}
+
+	close(fd);
+	return EXIT_SUCCESS;
+}
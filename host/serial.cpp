@@ -0,0 +1,123 @@
+/** \file Raw serial port access for the host tools.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "serial.h"
+
+
+int
+serial_open(
+	const char * const path
+)
+{
+	const int fd = open(path, O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		return -1;
+
+	// A pty or USB CDC port ignores the baud rate, but both need
+	// to be in raw mode so that binary frames pass through.
+	struct termios t;
+	if (tcgetattr(fd, &t) == 0)
+	{
+		cfmakeraw(&t);
+		cfsetspeed(&t, B115200);
+		t.c_cc[VMIN] = 0;
+		t.c_cc[VTIME] = 0;
+		tcsetattr(fd, TCSANOW, &t);
+	}
+
+	return fd;
+}
+
+
+ssize_t
+serial_read(
+	const int fd,
+	void * const buf,
+	const size_t len,
+	const int timeout_ms
+)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	const int rc = poll(&pfd, 1, timeout_ms);
+	if (rc < 0)
+		return errno == EINTR ? 0 : -1;
+	if (rc == 0)
+		return 0;
+	if ((pfd.revents & POLLIN) == 0)
+		return -1;
+
+	const ssize_t n = read(fd, buf, len);
+	if (n == 0)
+		return -1;
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	return n;
+}
+
+
+int
+serial_write(
+	const int fd,
+	const void * const buf,
+	const size_t len
+)
+{
+	const uint8_t * p = (const uint8_t *) buf;
+	size_t off = 0;
+
+	while (off < len)
+	{
+		const ssize_t n = write(fd, p + off, len - off);
+		if (n < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		off += n;
+	}
+
+	return 0;
+}
+
+
+int
+serial_command(
+	const int fd,
+	const char * const cmd
+)
+{
+	if (serial_write(fd, cmd, strlen(cmd)) < 0)
+		return -1;
+	return serial_write(fd, "\r", 1);
+}
+
+
+int
+serial_prompt(
+	const int fd,
+	const int timeout_ms,
+	void (*output)(const char * buf, size_t len)
+)
+{
+	char prev = 0;
+
+	while (1)
+	{
+		char c;
+		const ssize_t n = serial_read(fd, &c, 1, timeout_ms);
+		if (n <= 0)
+			return -1;
+
+		if (prev == '>' && c == ' ')
+			return 0;
+		if (prev && output)
+			output(&prev, 1);
+		prev = c;
+	}
+}
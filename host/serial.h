@@ -0,0 +1,63 @@
+/** \file
+ * Raw access to the PROMdate's USB serial port, or a pty standing in
+ * for it.
+ */
+#ifndef _host_serial_h_
+#define _host_serial_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Open a serial device in raw mode.
+ * \return the file descriptor, or -1 with errno set.
+ */
+extern int
+serial_open(
+	const char * path
+);
+
+
+/** Read whatever is available, waiting at most timeout_ms.
+ * \return bytes read, 0 on timeout, -1 on error or hangup.
+ */
+extern ssize_t
+serial_read(
+	int fd,
+	void * buf,
+	size_t len,
+	int timeout_ms
+);
+
+
+/** Write the whole buffer.
+ * \return 0 on success, -1 on error.
+ */
+extern int
+serial_write(
+	int fd,
+	const void * buf,
+	size_t len
+);
+
+
+/** Send a command line, terminated by a carriage return */
+extern int
+serial_command(
+	int fd,
+	const char * cmd
+);
+
+
+/** Read until the PROMdate prints its "> " prompt.
+ * Everything before it is passed to the output callback, if any.
+ * \return 0 once the prompt is seen, -1 on timeout or error.
+ */
+extern int
+serial_prompt(
+	int fd,
+	int timeout_ms,
+	void (*output)(const char * buf, size_t len)
+);
+
+#endif
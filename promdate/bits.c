@@ -3,6 +3,8 @@
  * ddr(0xA3, 1) == enable DDRA |= (1 << 3)
  * out(0xA3, 1) == PORTA |= (1 << 3)
  * in(0xA3) == PINA & (1 << 3)
+ * port_write(0xA, 0x0C, 0x04) == PORTA = (PORTA & ~0x0C) | 0x04
+ * port_read(0xA) == PINA
  */
 #include <avr/io.h>
 #include <avr/pgmspace.h>
@@ -113,3 +115,59 @@ in(
 
 	return 0;
 }
+
+
+void
+port_write(
+	const uint8_t port,
+	const uint8_t mask,
+	const uint8_t value
+)
+{
+	switch (port)
+	{
+	case 0xA:
+		PORTA = (PORTA & ~mask) | value;
+		return;
+	case 0xB:
+		PORTB = (PORTB & ~mask) | value;
+		return;
+	case 0xC:
+		PORTC = (PORTC & ~mask) | value;
+		return;
+	case 0xD:
+		PORTD = (PORTD & ~mask) | value;
+		return;
+	case 0xE:
+		PORTE = (PORTE & ~mask) | value;
+		return;
+	case 0xF:
+		PORTF = (PORTF & ~mask) | value;
+		return;
+	}
+}
+
+
+uint8_t
+port_read(
+	const uint8_t port
+)
+{
+	switch (port)
+	{
+	case 0xA:
+		return PINA;
+	case 0xB:
+		return PINB;
+	case 0xC:
+		return PINC;
+	case 0xD:
+		return PIND;
+	case 0xE:
+		return PINE;
+	case 0xF:
+		return PINF;
+	}
+
+	return 0;
+}
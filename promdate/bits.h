@@ -9,6 +9,9 @@
 #define _STR(X) #X
 #define STR(X) _STR(X)
 
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 extern void
 ddr(
@@ -29,4 +32,28 @@ in(
 	uint8_t port
 );
 
+
+/** Write several bits of a port at once.
+ * port_write(0xA, 0x0C, 0x04) == PORTA = (PORTA & ~0x0C) | 0x04
+ */
+extern void
+port_write(
+	uint8_t port,
+	uint8_t mask,
+	uint8_t value
+);
+
+
+/** Read all of the input bits of a port at once.
+ * port_read(0xA) == PINA
+ */
+extern uint8_t
+port_read(
+	uint8_t port
+);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
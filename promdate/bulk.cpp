@@ -0,0 +1,437 @@
+/**
+ * \file Windowed bulk dump, verify and batch read protocol.
+ *
+ * Using USB serial.  Frames are not buffered for retransmission;
+ * a NAK or timeout reads the frame from the chip again, and a
+ * verify frame that the host resends is compared again.
+ */
+
+#include <Arduino.h>
+#include "WProgram.h"
+#include <stdint.h>
+#include <string.h>
+#include "bulk.h"
+#include "crc32.h"
+#include "packbits.h"
+
+
+/** Frame currently being sent */
+static uint8_t tx_frame[BULK_HEADER + BULK_PAYLOAD + BULK_TRAILER];
+
+/** Partial frame from the host; only a verify sends payloads */
+static uint8_t rx_frame[BULK_HEADER + BULK_PAYLOAD + BULK_TRAILER];
+static uint16_t rx_len;
+
+
+/** Add the header and CRC to tx_frame and send it.
+ * The payload must already be in place after the header.
+ */
+static void
+bulk_frame(
+	const uint8_t type,
+	const uint32_t seq,
+	const uint16_t len
+)
+{
+	tx_frame[0] = BULK_MAGIC;
+	tx_frame[1] = type;
+	bulk_put16(&tx_frame[2], len);
+	bulk_put32(&tx_frame[4], seq);
+
+	const uint32_t crc = crc32_update(0, tx_frame, BULK_HEADER + len);
+	bulk_put32(&tx_frame[BULK_HEADER + len], crc);
+
+	Serial.write(tx_frame, BULK_HEADER + len + BULK_TRAILER);
+}
+
+
+/** Read a data frame from the chip and send it,
+ * PackBits encoded if that is shorter and packed is set.
+ */
+static void
+bulk_data(
+	const uint32_t seq,
+	const uint32_t offset,
+	const uint32_t size,
+	const bulk_fill_t fill,
+	const uint8_t packed
+)
+{
+	uint32_t pos = seq * BULK_PAYLOAD;
+	uint16_t len = BULK_PAYLOAD;
+	if (size - pos < len)
+		len = size - pos;
+	pos += offset;
+
+	uint8_t * const payload = &tx_frame[BULK_HEADER];
+	if (!packed)
+	{
+		fill(payload, pos, len);
+		bulk_frame(BULK_DATA, seq, len);
+		return;
+	}
+
+	uint8_t raw[BULK_PAYLOAD];
+	fill(raw, pos, len);
+
+	const uint16_t packed_len = packbits_encode(payload, len - 1, raw, len);
+	if (packed_len)
+	{
+		bulk_frame(BULK_PACKED, seq, packed_len);
+		return;
+	}
+
+	memcpy(payload, raw, len);
+	bulk_frame(BULK_DATA, seq, len);
+}
+
+
+/** Collect a frame from the host without blocking.
+ * Bytes are skipped until a magic number, and frames with a bad CRC
+ * or an oversized payload are dropped; the timeouts will recover
+ * from either.  The payload is left in rx_frame after the header.
+ * \return 1 if a frame was received, 0 if nothing is ready yet.
+ */
+static uint8_t
+bulk_recv(
+	uint8_t * const type,
+	uint32_t * const seq,
+	uint16_t * const len
+)
+{
+	while (1)
+	{
+		int c = Serial.read();
+		if (c == -1)
+			return 0;
+
+		if (rx_len == 0 && c != BULK_MAGIC)
+			continue;
+
+		rx_frame[rx_len++] = c;
+		if (rx_len < BULK_HEADER)
+			continue;
+
+		const uint16_t rx_payload = bulk_get16(&rx_frame[2]);
+		if (rx_payload > BULK_PAYLOAD)
+		{
+			rx_len = 0;
+			continue;
+		}
+		if (rx_len < BULK_HEADER + rx_payload + BULK_TRAILER)
+			continue;
+
+		rx_len = 0;
+		const uint32_t crc = crc32_update(0, rx_frame, BULK_HEADER + rx_payload);
+		if (crc != bulk_get32(&rx_frame[BULK_HEADER + rx_payload]))
+			continue;
+
+		*type = rx_frame[1];
+		*seq = bulk_get32(&rx_frame[4]);
+		*len = rx_payload;
+		return 1;
+	}
+}
+
+
+/** Send a control frame until the host ACKs it.
+ * \return 0 on success, -1 on cancel or timeout.
+ */
+static int8_t
+bulk_handshake(
+	const uint8_t type,
+	const uint32_t seq,
+	const uint16_t len,
+	const uint32_t ack
+)
+{
+	for (uint8_t retry = 0 ; retry < BULK_RETRIES ; retry++)
+	{
+		bulk_frame(type, seq, len);
+
+		const uint32_t start = millis();
+		while (millis() - start < BULK_TIMEOUT_MS)
+		{
+			uint8_t rx_type;
+			uint32_t rx_seq;
+			uint16_t rx_payload;
+			if (!bulk_recv(&rx_type, &rx_seq, &rx_payload))
+				continue;
+			if (rx_type == BULK_CAN)
+				return -1;
+			if (rx_type == BULK_ACK && rx_seq == ack)
+				return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+int32_t
+bulk_send(
+	const uint32_t offset,
+	const uint32_t size,
+	const bulk_fill_t fill,
+	const uint8_t packed
+)
+{
+	const uint32_t frames = (size + BULK_PAYLOAD - 1) / BULK_PAYLOAD;
+	uint32_t base = 0; // oldest unacknowledged frame
+	uint32_t next = 0; // next new frame to send
+	int32_t resent = 0;
+	uint8_t retries = 0;
+
+	rx_len = 0;
+
+	bulk_put32(&tx_frame[BULK_HEADER + 0], size);
+	bulk_put16(&tx_frame[BULK_HEADER + 4], BULK_PAYLOAD);
+	bulk_put32(&tx_frame[BULK_HEADER + 6], offset);
+	if (bulk_handshake(BULK_START, 0, 10, 0) < 0)
+		return -1;
+
+	uint32_t last = millis();
+	while (base < frames)
+	{
+		uint8_t type;
+		uint32_t seq;
+		uint16_t len;
+		if (bulk_recv(&type, &seq, &len))
+		{
+			if (type == BULK_CAN)
+				return -1;
+
+			if (type == BULK_ACK && base < seq && seq <= next)
+			{
+				base = seq;
+				last = millis();
+				retries = 0;
+			} else
+			if (type == BULK_NAK && base <= seq && seq < next)
+			{
+				bulk_data(seq, offset, size, fill, packed);
+				resent++;
+			}
+			continue;
+		}
+
+		// Keep the window full
+		if (next < frames && next - base < BULK_WINDOW)
+		{
+			bulk_data(next++, offset, size, fill, packed);
+			continue;
+		}
+
+		// Nothing has been acknowledged for a while,
+		// the oldest frame or its ACK was probably lost.
+		if (millis() - last > BULK_TIMEOUT_MS)
+		{
+			if (++retries > BULK_RETRIES)
+				return -1;
+			bulk_data(base, offset, size, fill, packed);
+			resent++;
+			last = millis();
+		}
+	}
+
+	if (bulk_handshake(BULK_END, frames, 0, frames) < 0)
+		return -1;
+
+	return resent;
+}
+
+
+/** Image size and chip access for the request being served */
+static uint32_t serve_size;
+static bulk_fill_t serve_fill;
+static bulk_read_t serve_read;
+
+/** Answer a request frame whose payload is still in rx_frame */
+typedef void (*bulk_answer_t)(
+	uint32_t seq,
+	uint16_t len
+);
+
+
+/** Compare a frame of the expected image from the host against the
+ * chip and send the reply.
+ */
+static void
+bulk_compare(
+	const uint32_t seq,
+	const uint16_t len
+)
+{
+	if (len == 0
+	||  seq >= (serve_size + BULK_PAYLOAD - 1) / BULK_PAYLOAD
+	||  len > serve_size - seq * BULK_PAYLOAD)
+	{
+		bulk_frame(BULK_NAK, seq, 0);
+		return;
+	}
+
+	uint8_t actual[BULK_PAYLOAD];
+	serve_fill(actual, seq * BULK_PAYLOAD, len);
+
+	const uint8_t * const expected = &rx_frame[BULK_HEADER];
+	uint8_t * const out = &tx_frame[BULK_HEADER];
+	uint16_t out_len = 0;
+
+	for (uint16_t i = 0 ; i < len ; i++)
+	{
+		if (actual[i] == expected[i])
+			continue;
+
+		// Records would be larger than the data itself
+		if (out_len + BULK_DIFF_RECORD > BULK_PAYLOAD)
+		{
+			memcpy(out, actual, len);
+			bulk_frame(BULK_READ, seq, len);
+			return;
+		}
+
+		out[out_len++] = i;
+		out[out_len++] = expected[i];
+		out[out_len++] = actual[i];
+	}
+
+	bulk_frame(out_len ? BULK_DIFF : BULK_ACK, seq, out_len);
+}
+
+
+/** Read the bytes described by an address list from the host and
+ * send them back in one frame, or a NAK if the list is malformed.
+ */
+static void
+bulk_list(
+	const uint32_t seq,
+	const uint16_t len
+)
+{
+	const uint8_t * const list = &rx_frame[BULK_HEADER];
+	uint8_t * const out = &tx_frame[BULK_HEADER];
+	uint16_t out_len = 0;
+	uint16_t i = 0;
+
+	while (i < len)
+	{
+		if (len - i < 4)
+			goto malformed;
+
+		uint32_t pos = bulk_get32(&list[i]);
+		uint16_t stride = 0;
+		uint16_t count = 1;
+		i += 4;
+
+		if (pos & BULK_LIST_RANGE)
+		{
+			if (len - i < 4)
+				goto malformed;
+			pos &= ~BULK_LIST_RANGE;
+			stride = bulk_get16(&list[i + 0]);
+			count = bulk_get16(&list[i + 2]);
+			i += 4;
+		}
+
+		if (count > BULK_PAYLOAD - out_len)
+			goto malformed;
+
+		for (uint16_t n = 0 ; n < count ; n++, pos += stride)
+		{
+			if (pos >= serve_size)
+				goto malformed;
+			out[out_len++] = serve_read(pos);
+		}
+	}
+
+	bulk_frame(BULK_DATA, seq, out_len);
+	return;
+
+malformed:
+	bulk_frame(BULK_NAK, seq, 0);
+}
+
+
+/** Announce the image size, then answer each request frame of the
+ * given type until the host sends BULK_END.
+ * \return the number of requests that were answered more than once,
+ * or -1 if the host cancelled or stopped responding.
+ */
+static int32_t
+bulk_serve(
+	const uint8_t request,
+	const bulk_answer_t answer
+)
+{
+	uint32_t answered = 0;
+	uint8_t retries = 0;
+
+	rx_len = 0;
+
+	bulk_put32(&tx_frame[BULK_HEADER + 0], serve_size);
+	bulk_put16(&tx_frame[BULK_HEADER + 4], BULK_PAYLOAD);
+	if (bulk_handshake(BULK_START, 0, 6, 0) < 0)
+		return -1;
+
+	uint32_t last = millis();
+	while (1)
+	{
+		uint8_t type;
+		uint32_t seq;
+		uint16_t len;
+		if (!bulk_recv(&type, &seq, &len))
+		{
+			// The host resends unanswered frames, so silence
+			// means that it has gone away.
+			if (millis() - last > BULK_TIMEOUT_MS)
+			{
+				if (++retries > BULK_RETRIES)
+					return -1;
+				last = millis();
+			}
+			continue;
+		}
+
+		last = millis();
+		retries = 0;
+
+		if (type == BULK_CAN)
+			return -1;
+
+		if (type == request)
+		{
+			answer(seq, len);
+			answered++;
+		} else
+		if (type == BULK_END)
+		{
+			if (bulk_handshake(BULK_END, seq, 0, seq) < 0)
+				return -1;
+			return answered > seq ? answered - seq : 0;
+		}
+	}
+}
+
+
+int32_t
+bulk_verify(
+	const uint32_t size,
+	const bulk_fill_t fill
+)
+{
+	serve_size = size;
+	serve_fill = fill;
+	return bulk_serve(BULK_DATA, bulk_compare);
+}
+
+
+int32_t
+bulk_batch(
+	const uint32_t size,
+	const bulk_read_t read
+)
+{
+	serve_size = size;
+	serve_read = read;
+	return bulk_serve(BULK_LIST, bulk_list);
+}
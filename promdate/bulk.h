@@ -0,0 +1,207 @@
+/** \file
+ * Windowed bulk dump protocol.
+ *
+ * xmodem only allows one block in flight, which leaves most of the
+ * USB serial bandwidth unused.  The bulk protocol streams numbered
+ * frames and keeps up to BULK_WINDOW of them unacknowledged.
+ *
+ * Every frame, in either direction, is
+ *
+ *	magic (0xB5)
+ *	type
+ *	payload length, 16 bits little endian
+ *	sequence number, 32 bits little endian
+ *	payload
+ *	CRC-32 of everything above, 32 bits little endian
+ *
+ * The device sends BULK_START, with the size, frame payload size and
+ * image offset as the payload, and waits for the host to ACK it.  It
+ * then sends BULK_DATA frames numbered from 0, each holding
+ * BULK_PAYLOAD bytes of the image starting at offset + seq *
+ * BULK_PAYLOAD.  The offset is non-zero for a ranged dump, which lets
+ * the host resume a transfer that failed part way.  The host
+ * replies with a cumulative BULK_ACK naming the next frame it needs,
+ * and a BULK_NAK for a frame that was lost or corrupted, which the
+ * device then re-reads from the chip and resends.  If nothing is
+ * acknowledged for BULK_TIMEOUT_MS the oldest frame is resent.
+ * Finally the device sends BULK_END until the host ACKs it.
+ *
+ * A compressed dump is the same, except that a frame may instead be
+ * BULK_PACKED, with its range of the image PackBits encoded, when
+ * that is shorter.  Erased and sparse chips then take a fraction of
+ * the frame bytes on the wire.
+ *
+ * A verify runs the other way.  After the same BULK_START handshake
+ * the host sends the expected image as BULK_DATA frames, keeping up
+ * to BULK_WINDOW of them unanswered.  The device reads each frame's
+ * range from the chip and answers it with a single frame of the same
+ * sequence number: a BULK_ACK if it matched, BULK_DIFF records for
+ * the bytes that differ, or BULK_READ with the whole range as read if
+ * there are too many differences for records.  The device keeps no
+ * state between frames, so the host simply resends any frame that
+ * is not answered within BULK_TIMEOUT_MS.  Once every frame has been
+ * answered the host sends BULK_END, and the device sends BULK_END
+ * back until the host ACKs it.
+ *
+ * A batch read works the same way as a verify, except that the host
+ * sends BULK_LIST frames of addresses, and the device answers each
+ * one with a BULK_DATA frame holding the bytes at those addresses.
+ * A NAK in reply to a verify or batch request means that it is out
+ * of range or malformed, and is not worth resending.
+ *
+ * This header is shared with the host tools.
+ */
+#ifndef _prom_bulk_h_
+#define _prom_bulk_h_
+
+#include <stdint.h>
+
+#define BULK_MAGIC 0xB5
+
+#define BULK_HEADER 8
+#define BULK_TRAILER 4
+
+/** Largest payload in any frame */
+#define BULK_PAYLOAD 256
+
+/** Frames that may be sent before the oldest one is acknowledged */
+#define BULK_WINDOW 16
+
+/** Time without progress before the oldest frame is resent */
+#define BULK_TIMEOUT_MS 250
+
+/** Timeouts in a row before the transfer is abandoned */
+#define BULK_RETRIES 20
+
+// Device to host
+#define BULK_START 'S' // payload: size (32 bits), frame payload (16 bits),
+                       // and offset (32 bits) for a dump
+#define BULK_DATA 'D'  // payload: image data
+#define BULK_PACKED 'P' // payload: image data, PackBits encoded
+#define BULK_END 'E'   // seq: number of data frames
+
+// Host to device
+#define BULK_ACK 'A' // seq: next frame needed
+#define BULK_NAK 'N' // seq: frame to resend
+#define BULK_CAN 'X' // abort the transfer
+
+// Device to host, in reply to each BULK_DATA frame of a verify
+#define BULK_DIFF 'F' // payload: difference records
+#define BULK_READ 'R' // payload: the frame's range as read from the chip
+
+/** Each difference record is the offset in the frame, the expected
+ * byte and the byte read from the chip.  The offset is eight bits,
+ * which limits BULK_PAYLOAD to 256.
+ */
+#define BULK_DIFF_RECORD 3
+
+// Host to device, for a batch read
+#define BULK_LIST 'L' // payload: address list entries
+
+/** Each entry of a BULK_LIST is a byte offset in the image, 32 bits
+ * little endian.  If BULK_LIST_RANGE is set in it, it is followed by
+ * a stride and a count, 16 bits each, for count bytes at offset,
+ * offset + stride and so on.  The entries in one list may describe
+ * at most BULK_PAYLOAD bytes, which are returned in order.
+ */
+#define BULK_LIST_RANGE 0x80000000UL
+
+
+static inline void
+bulk_put16(
+	uint8_t * const p,
+	const uint16_t x
+)
+{
+	p[0] = x >> 0;
+	p[1] = x >> 8;
+}
+
+
+static inline void
+bulk_put32(
+	uint8_t * const p,
+	const uint32_t x
+)
+{
+	p[0] = x >> 0;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+
+static inline uint16_t
+bulk_get16(
+	const uint8_t * const p
+)
+{
+	return p[0] | (uint16_t) p[1] << 8;
+}
+
+
+static inline uint32_t
+bulk_get32(
+	const uint8_t * const p
+)
+{
+	return p[0]
+		| (uint32_t) p[1] << 8
+		| (uint32_t) p[2] << 16
+		| (uint32_t) p[3] << 24;
+}
+
+
+/** Fill len bytes of the image starting at byte offset pos */
+typedef void (*bulk_fill_t)(
+	uint8_t * buf,
+	uint32_t pos,
+	uint16_t len
+);
+
+
+/** Read one byte of the image at offset pos */
+typedef uint8_t (*bulk_read_t)(
+	uint32_t pos
+);
+
+
+/** Send size bytes of an image, starting at offset, over the USB
+ * serial port, with BULK_PACKED frames where they are shorter if
+ * packed is set.  fill is given offsets from the start of the image.
+ * \return the number of frames that had to be resent,
+ * or -1 if the host cancelled or stopped responding.
+ */
+extern int32_t
+bulk_send(
+	uint32_t offset,
+	uint32_t size,
+	bulk_fill_t fill,
+	uint8_t packed
+);
+
+
+/** Compare an image of size bytes against one streamed from the host
+ * over the USB serial port, replying with only the differences.
+ * \return the number of frames that the host had to resend,
+ * or -1 if the host cancelled or stopped responding.
+ */
+extern int32_t
+bulk_verify(
+	uint32_t size,
+	bulk_fill_t fill
+);
+
+
+/** Read the bytes named in address lists from the host, for an
+ * image of size bytes, replying to each list with one frame.
+ * \return the number of lists that the host had to resend,
+ * or -1 if the host cancelled or stopped responding.
+ */
+extern int32_t
+bulk_batch(
+	uint32_t size,
+	bulk_read_t read
+);
+
+#endif
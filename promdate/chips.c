@@ -1,7 +1,13 @@
 #include "chips.h"
 #include "bits.h"
 
-const prom_t proms[] = {
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#endif
+
+const prom_t proms[] PROGMEM = {
 {
 	// Default is to leave everything in tristate mode
 	.name		= "NONE",
@@ -36,6 +42,7 @@ const prom_t proms[] = {
 	.lo_pins	= { 22, 20, 14, },
 	.vcc		= 28,
 	.gnd		= 14,
+	.access_ns	= 250, // -25
 },
 {
 	.name		= "M27C256",
@@ -54,6 +61,7 @@ const prom_t proms[] = {
 
 	.vcc		= 28,
 	.gnd		= 14,
+	.access_ns	= 250, // -25
 },
 {
 	.name		= "M27C128",
@@ -72,6 +80,7 @@ const prom_t proms[] = {
 
 	.vcc		= 28,
 	.gnd		= 14,
+	.access_ns	= 250,
 },
 {
 	.name		= "AM27C040",
@@ -91,6 +100,7 @@ const prom_t proms[] = {
 
 	.vcc		= 32,
 	.gnd		= 16,
+	.access_ns	= 250, // -255
 },
 {
 	.name		= "LH-535618",
@@ -112,6 +122,7 @@ const prom_t proms[] = {
 
 	.vcc		= 1,
 	.gnd		= 14,
+	.access_ns	= 250,
 },
 {
 	.name		= "M27C64",
@@ -130,6 +141,7 @@ const prom_t proms[] = {
 
 	.vcc		= 28,
 	.gnd		= 14,
+	.access_ns	= 300,
 },
 {
 	.name		= "87C64",
@@ -152,6 +164,7 @@ const prom_t proms[] = {
 
 	.vcc		= 28,
 	.gnd		= 14,
+	.access_ns	= 250,
 },
 {
 	.name		= "C64-2732",
@@ -170,6 +183,7 @@ const prom_t proms[] = {
 
 	.vcc		= 24,
 	.gnd		= 12,
+	.access_ns	= 450,
 },
 {
 	/** 512x8 PROM -- UNTESTED */	
@@ -185,6 +199,7 @@ const prom_t proms[] = {
 	},
 	.hi_pins	= { 20 },
 	.lo_pins	= { 10, 15 },
+	.access_ns	= 55,
 },
 
 {
@@ -206,6 +221,7 @@ const prom_t proms[] = {
 		1,  // vpp
 	},
 	.lo_pins	= { 22, 20, 14, }, // !oe, !cs, gnd
+	.access_ns	= 300,
 },
 {
 	// C64 kernel and basic ROMs
@@ -232,6 +248,7 @@ const prom_t proms[] = {
 
 	.vcc		= 40,
 	.gnd		= 11,
+	.access_ns	= 250,
 },
 {
 	// Space laptop
@@ -258,6 +275,7 @@ const prom_t proms[] = {
 
 	.vcc		= 32,
 	.gnd		= 16,
+	.access_ns	= 250, // -255
 },
 {
 	/** Apple Mac SE PROM chips
@@ -277,6 +295,7 @@ const prom_t proms[] = {
 	},
 	.hi_pins	= { 28, },
 	.lo_pins	= { 20, 14, },
+	.access_ns	= 250, // as the M27C512
 },
 {
 	.name		= "28F512 (untstd)",
@@ -302,6 +321,7 @@ const prom_t proms[] = {
 
 	.vcc		= 32,
 	.gnd		= 16,
+	.access_ns	= 200,
 },
 {
 	// C64 kernel and basic ROMs
@@ -325,6 +345,7 @@ const prom_t proms[] = {
 
 	.vcc		= 24,
 	.gnd		= 12,
+	.access_ns	= 450,
 },
 {
 	/** 2716 mask ROM used in video games.
@@ -347,6 +368,7 @@ const prom_t proms[] = {
 
 	.vcc		= 24,
 	.gnd		= 12,
+	.access_ns	= 450,
 },
 {
 	/** 9316 mask ROM used in video games.
@@ -369,6 +391,7 @@ const prom_t proms[] = {
 
 	.vcc		= 24,
 	.gnd		= 12,
+	.access_ns	= 450,
 },
 {
 	.name		= "HN462732",
@@ -392,6 +415,7 @@ const prom_t proms[] = {
 
 	.vcc		= 24,
 	.gnd		= 12,
+	.access_ns	= 450,
 },
 {
 	/** atmega8.
@@ -401,6 +425,7 @@ const prom_t proms[] = {
 	.name		= "ATMega8",
 	.pins		= 28,
 	.addr_width	= 13,
+	.eeprom_width	= 9,
 	.addr_pins	= {
 		[ISP_MOSI] = 17, // from the reader to the chip
 		[ISP_SCK] = 19, // SCK,
@@ -422,6 +447,60 @@ const prom_t proms[] = {
 	.vcc		= 7,
 	.gnd		= 8,
 },
+{
+	// Same pinout as the ATMega8; also the ATMega328P
+	.name		= "ATMega328",
+	.pins		= 28,
+	.addr_width	= 15,
+	.eeprom_width	= 10,
+	.addr_pins	= {
+		[ISP_MOSI] = 17,
+		[ISP_SCK] = 19,
+		[ISP_RESET] = 1,
+		[ISP_XTAL] = 9,
+	},
+	.data_pins	= {
+		[ISP_MISO] = 18,
+	},
+	.lo_pins	= {
+		8, // gnd
+		22, // gnd
+	},
+	.hi_pins	= {
+		7, // vcc
+		20, // avcc
+	},
+
+	.vcc		= 7,
+	.gnd		= 8,
+},
+{
+	// 40 pin DIP, as the ATMega16/32/644
+	.name		= "ATMega1284",
+	.pins		= 40,
+	.addr_width	= 17,
+	.eeprom_width	= 12,
+	.addr_pins	= {
+		[ISP_MOSI] = 6,
+		[ISP_SCK] = 8,
+		[ISP_RESET] = 9,
+		[ISP_XTAL] = 13,
+	},
+	.data_pins	= {
+		[ISP_MISO] = 7,
+	},
+	.lo_pins	= {
+		11, // gnd
+		31, // gnd
+	},
+	.hi_pins	= {
+		10, // vcc
+		30, // avcc
+	},
+
+	.vcc		= 10,
+	.gnd		= 11,
+},
 };
 
 const uint16_t proms_count = array_count(proms);
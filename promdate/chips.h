@@ -7,10 +7,15 @@
 #define OPTIONS_PULLUPS 0x01
 // Needs a latch pulse
 #define OPTIONS_LATCH   0x02
+// 16-bit data is stored high byte first
+#define OPTIONS_BIG_ENDIAN 0x04
 
 // Output pin for OPTIONS_LATCH
 #define LATCH_PIN 0
 
+// Access time to assume for chips that do not list one, in ns
+#define DEFAULT_ACCESS_NS 450
+
 // For AVR chips
 #define ISP_MOSI 0
 #define ISP_MISO 0
@@ -30,7 +35,9 @@ typedef struct
 	uint8_t pins;
 
 	/** Total number of address pins.
-	 * The download will retrieve 2^addr_width bytes.
+	 * The download will retrieve 2^addr_width words,
+	 * each of which is two bytes if data_width > 8.
+	 * For ISP chips this is log2 of the flash size in bytes.
  	 */
 	uint8_t addr_width;
 
@@ -81,9 +88,35 @@ typedef struct
    */
   uint8_t gnd;
 
+	/** Address to data out access time (tACC) in nanoseconds.
+	 * Use the slowest speed grade on the datasheet; the read path
+	 * adds a safety margin.  0 selects DEFAULT_ACCESS_NS.
+	 * There is no tOE: /OE and /CE are lo_pins, pulled low once by
+	 * prom_setup() and held there, so only address changes need
+	 * time to settle.
+	 */
+	uint16_t access_ns;
+
+	/** For ISP chips, log2 of the EEPROM size in bytes, which is
+	 * dumped after the flash.  0 if there is none.
+	 */
+	uint8_t eeprom_width;
+
 } prom_t;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The chip table lives in flash on the AVR, so entries must be
+ * copied out with memcpy_P() or read with pgm_read_byte() rather
+ * than dereferenced.
+ */
 extern const prom_t proms[];
 extern const uint16_t proms_count;
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // CHIPS_H
@@ -0,0 +1,41 @@
+/** \file CRC-32 with a nibble table.
+ *
+ * A 16 entry table is a good trade between the 1 KB byte table
+ * and the bit at a time loop on the AVR.
+ */
+#include "crc32.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_dword(p) (*(p))
+#endif
+
+static const uint32_t crc32_table[16] PROGMEM = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+
+uint32_t
+crc32_update(
+	uint32_t crc,
+	const void * const buf,
+	size_t len
+)
+{
+	const uint8_t * p = buf;
+	crc = ~crc;
+
+	while (len--)
+	{
+		const uint8_t b = *p++;
+		crc = pgm_read_dword(&crc32_table[(crc ^ b) & 0xF]) ^ (crc >> 4);
+		crc = pgm_read_dword(&crc32_table[(crc ^ (b >> 4)) & 0xF]) ^ (crc >> 4);
+	}
+
+	return ~crc;
+}
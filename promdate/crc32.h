@@ -0,0 +1,31 @@
+/** \file
+ * CRC-32 (IEEE 802.3, as used by zlib and PNG).
+ *
+ * Shared by the firmware and the host tools.
+ */
+#ifndef _prom_crc32_h_
+#define _prom_crc32_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Update a CRC-32 with more data.
+ * Start with crc == 0; the value returned is the finished CRC of
+ * everything so far, the same as zlib's crc32().
+ */
+extern uint32_t
+crc32_update(
+	uint32_t crc,
+	const void * buf,
+	size_t len
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+/** \file PackBits run-length coding.
+ *
+ * Runs of three or more bytes are repeated, anything shorter is
+ * copied, so a literal run is never broken up by a pair.
+ */
+#include <string.h>
+#include "packbits.h"
+
+/** Longest run that a single header byte can describe */
+#define PACKBITS_RUN 128
+
+
+uint16_t
+packbits_encode(
+	uint8_t * const out,
+	const uint16_t max,
+	const uint8_t * const in,
+	const uint16_t len
+)
+{
+	uint16_t i = 0;
+	uint16_t o = 0;
+
+	while (i < len)
+	{
+		uint16_t run = 1;
+		while (i + run < len && run < PACKBITS_RUN && in[i + run] == in[i])
+			run++;
+
+		if (run >= 3)
+		{
+			if (o + 2 > max)
+				return 0;
+			out[o++] = 257 - run;
+			out[o++] = in[i];
+			i += run;
+			continue;
+		}
+
+		// Copy up to the start of the next run of three
+		const uint16_t start = i;
+		while (i < len && i - start < PACKBITS_RUN)
+		{
+			if (i + 2 < len && in[i] == in[i + 1] && in[i] == in[i + 2])
+				break;
+			i++;
+		}
+
+		const uint16_t count = i - start;
+		if (o + 1 + count > max)
+			return 0;
+		out[o++] = count - 1;
+		memcpy(&out[o], &in[start], count);
+		o += count;
+	}
+
+	return o;
+}
+
+
+int32_t
+packbits_decode(
+	uint8_t * const out,
+	const size_t max,
+	const uint8_t * const in,
+	const size_t len
+)
+{
+	size_t i = 0;
+	size_t o = 0;
+
+	while (i < len)
+	{
+		const uint8_t n = in[i++];
+		if (n == 128)
+			continue;
+
+		if (n < 128)
+		{
+			const size_t count = n + 1;
+			if (i + count > len || o + count > max)
+				return -1;
+			memcpy(&out[o], &in[i], count);
+			i += count;
+			o += count;
+			continue;
+		}
+
+		const size_t count = 257 - n;
+		if (i + 1 > len || o + count > max)
+			return -1;
+		memset(&out[o], in[i++], count);
+		o += count;
+	}
+
+	return o;
+}
@@ -0,0 +1,48 @@
+/** \file
+ * PackBits run-length coding, as read by unpackbits.py.
+ *
+ * Each run starts with a header byte n: 0 to 127 copies the next
+ * n + 1 bytes, 129 to 255 repeats the next byte 257 - n times and
+ * 128 is skipped.
+ *
+ * Shared by the firmware and the host tools.
+ */
+#ifndef _prom_packbits_h_
+#define _prom_packbits_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Encode len bytes of in into at most max bytes of out.
+ * \return the encoded length, or 0 if it would not fit.
+ */
+extern uint16_t
+packbits_encode(
+	uint8_t * out,
+	uint16_t max,
+	const uint8_t * in,
+	uint16_t len
+);
+
+
+/** Decode len bytes of in into at most max bytes of out.
+ * \return the decoded length, or -1 if the input is truncated
+ * or would overflow out.
+ */
+extern int32_t
+packbits_decode(
+	uint8_t * out,
+	size_t max,
+	const uint8_t * in,
+	size_t len
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,164 @@
+/** \file Precompiled address and data pin plans.
+ *
+ * The plans are built once in prom_setup() so that the per-byte
+ * read path does not need to decode pin ids or remap pins.
+ */
+#include <string.h>
+#include "bits.h"
+#include "plan.h"
+
+
+void
+addr_plan_build(
+	addr_plan_t * const plan,
+	const uint8_t * const pins,
+	const uint8_t width
+)
+{
+	memset(plan, 0, sizeof(*plan));
+	plan->nibbles = (width + 3) / 4;
+
+	for (uint8_t i = 0 ; i < width ; i++)
+	{
+		const uint8_t id = pins[i];
+		if (id == 0)
+			continue;
+
+		const uint8_t port = (id >> 4) & 0xF;
+		const uint8_t bit = 1 << (id & 0x7);
+
+		// Find the port in the plan, or add it if this is
+		// the first address line on that port.
+		uint8_t p;
+		for (p = 0 ; p < plan->ports ; p++)
+			if (plan->port[p].port == port)
+				break;
+
+		plan_port_t * const pp = &plan->port[p];
+		if (p == plan->ports)
+		{
+			plan->ports++;
+			pp->port = port;
+		}
+
+		pp->mask |= bit;
+		pp->addr_bits |= ((uint32_t) 1) << i;
+
+		// Every nibble value with this address bit set
+		// turns on the port bit.
+		const uint8_t nibble = i / 4;
+		const uint8_t nibble_bit = 1 << (i % 4);
+		for (uint8_t v = 0 ; v < 16 ; v++)
+			if (v & nibble_bit)
+				pp->scatter[nibble][v] |= bit;
+	}
+}
+
+
+/** Write the ports whose address bits intersect the changed bits */
+static void
+addr_plan_write_ports(
+	const addr_plan_t * const plan,
+	uint32_t addr,
+	const uint32_t changed
+)
+{
+	uint8_t nib[PLAN_NIBBLES];
+	for (uint8_t n = 0 ; n < plan->nibbles ; n++)
+	{
+		nib[n] = addr & 0xF;
+		addr >>= 4;
+	}
+
+	for (uint8_t p = 0 ; p < plan->ports ; p++)
+	{
+		const plan_port_t * const pp = &plan->port[p];
+		if ((pp->addr_bits & changed) == 0)
+			continue;
+
+		uint8_t value = 0;
+		for (uint8_t n = 0 ; n < plan->nibbles ; n++)
+			value |= pp->scatter[n][nib[n]];
+
+		port_write(pp->port, pp->mask, value);
+	}
+}
+
+
+void
+addr_plan_write(
+	const addr_plan_t * const plan,
+	const uint32_t addr
+)
+{
+	addr_plan_write_ports(plan, addr, 0xFFFFFFFF);
+}
+
+
+void
+addr_plan_step(
+	const addr_plan_t * const plan,
+	const uint32_t addr,
+	const uint32_t prev
+)
+{
+	const uint32_t changed = addr ^ prev;
+	if (changed == 0)
+		return;
+
+	addr_plan_write_ports(plan, addr, changed);
+}
+
+
+void
+data_plan_build(
+	data_plan_t * const plan,
+	const uint8_t * const pins,
+	const uint8_t width
+)
+{
+	memset(plan, 0, sizeof(*plan));
+
+	for (uint8_t i = 0 ; i < width ; i++)
+	{
+		const uint8_t id = pins[i];
+		const uint8_t port = (id >> 4) & 0xF;
+		const uint8_t bit = id & 0x7;
+
+		uint8_t p;
+		for (p = 0 ; p < plan->ports ; p++)
+			if (plan->port[p].port == port)
+				break;
+
+		plan_data_port_t * const pp = &plan->port[p];
+		if (p == plan->ports)
+		{
+			plan->ports++;
+			pp->port = port;
+		}
+
+		// Every nibble value with this port bit set
+		// turns on the data bit.
+		const uint8_t nibble_bit = 1 << (bit % 4);
+		for (uint8_t v = 0 ; v < 16 ; v++)
+			if (v & nibble_bit)
+				pp->gather[bit / 4][v] |= ((uint16_t) 1) << i;
+	}
+}
+
+
+uint16_t
+data_plan_read(
+	const data_plan_t * const plan
+)
+{
+	uint16_t r = 0;
+	for (uint8_t p = 0 ; p < plan->ports ; p++)
+	{
+		const plan_data_port_t * const pp = &plan->port[p];
+		const uint8_t v = port_read(pp->port);
+		r |= pp->gather[0][v & 0xF] | pp->gather[1][v >> 4];
+	}
+
+	return r;
+}
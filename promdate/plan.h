@@ -0,0 +1,132 @@
+/** \file
+ * Precompiled pin plans.
+ *
+ * Rather than walking the address pins one at a time through out(),
+ * prom_setup() builds a plan that records which bits of each AVR
+ * port carry the address, along with a scatter table for each
+ * address nibble.  Driving an address is then one masked write
+ * per port that is in use, at most six for the whole address.
+ *
+ * For sequential reads addr_plan_step() only rewrites the ports
+ * whose address bits differ from the previously driven address.
+ *
+ * The data pins get the reverse: a gather table for each nibble of
+ * each port that carries data, so a sample is one port_read() per
+ * port and two table lookups, rather than a call to in() per bit.
+ */
+#ifndef _prom_plan_h_
+#define _prom_plan_h_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** AVR ports A through F can be wired to the ZIF socket */
+#define PLAN_PORTS 6
+
+/** Up to 24 address bits, scattered four at a time */
+#define PLAN_NIBBLES 6
+
+typedef struct
+{
+	/** Port id, 0xA to 0xF */
+	uint8_t port;
+
+	/** Bits of the port that are driven by the address */
+	uint8_t mask;
+
+	/** Address bits that land on this port */
+	uint32_t addr_bits;
+
+	/** Port bits to set for each value of each address nibble */
+	uint8_t scatter[PLAN_NIBBLES][16];
+} plan_port_t;
+
+typedef struct
+{
+	/** Number of entries used in port[] */
+	uint8_t ports;
+
+	/** Number of address nibbles that need to be looked up */
+	uint8_t nibbles;
+
+	plan_port_t port[PLAN_PORTS];
+} addr_plan_t;
+
+typedef struct
+{
+	/** Port id, 0xA to 0xF */
+	uint8_t port;
+
+	/** Data bits for each value of the low and high port nibble */
+	uint16_t gather[2][16];
+} plan_data_port_t;
+
+typedef struct
+{
+	/** Number of entries used in port[] */
+	uint8_t ports;
+
+	plan_data_port_t port[PLAN_PORTS];
+} data_plan_t;
+
+
+/** Build the plan for a set of address pins.
+ * \param pins AVR pin ids (0xPN) for each address bit, LSB first.
+ * Any that are 0 are ignored.
+ */
+extern void
+addr_plan_build(
+	addr_plan_t * plan,
+	const uint8_t * pins,
+	uint8_t width
+);
+
+
+/** Drive an address onto the pins described by the plan */
+extern void
+addr_plan_write(
+	const addr_plan_t * plan,
+	uint32_t addr
+);
+
+
+/** Move from one address to the next, only touching the ports
+ * that carry address bits that have changed.
+ * \param prev The address that is currently driven on the pins.
+ */
+extern void
+addr_plan_step(
+	const addr_plan_t * plan,
+	uint32_t addr,
+	uint32_t prev
+);
+
+
+
+/** Build the plan for a set of data pins.
+ * \param pins AVR pin ids (0xPN) for each data bit, LSB first.
+ */
+extern void
+data_plan_build(
+	data_plan_t * plan,
+	const uint8_t * pins,
+	uint8_t width
+);
+
+
+/** Sample the data pins described by the plan,
+ * with the first pin in bit 0.
+ */
+extern uint16_t
+data_plan_read(
+	const data_plan_t * plan
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,9 +10,15 @@
 #include <stdint.h>
 //#include <string.h>
 #include <util/delay.h>
+#include <util/delay_basic.h>
+#include <avr/eeprom.h>
 #include "xmodem.h"
+#include "bulk.h"
 #include "bits.h"
 #include "chips.h"
+#include "plan.h"
+#include "crc32.h"
+#include "sha256.h"
 
 uint8_t recv_str(char *buf, uint8_t size);
 void parse_and_execute_command(const char *buf, uint8_t num);
@@ -99,8 +105,248 @@ static const uint8_t ports[ZIF_PINS+1] = {
 	0xB7, // 40
 };
 
-/** Select one of the chips */
-static const prom_t * prom = &proms[0];
+/** The selected chip.  proms[] stays in flash and prom_load()
+ * copies the entry in use here, so only one prom_t takes up SRAM.
+ */
+static prom_t prom_cache;
+static const prom_t * const prom = &prom_cache;
+
+/** Index in proms[] of the entry in prom_cache */
+static uint16_t prom_index;
+
+/** No entry in proms[], for the calibrated and probed chips */
+#define PROM_INDEX_NONE 0xFFFF
+
+/** Port masks and scatter tables for the selected chip's address pins.
+ * Rebuilt by prom_setup() whenever the chip is (re)configured.
+ */
+static addr_plan_t addr_plan;
+
+/** Gather tables for the selected chip's data pins, built with the
+ * address plan.
+ */
+static data_plan_t data_plan;
+
+/** The address currently driven on the pins.
+ * prom_setup() drives every address line low, so it starts at 0.
+ */
+static uint32_t prom_addr;
+
+/** Walk the address space in Gray code order during dumps.
+ * Only one address line changes per word; use gray-reorder on the
+ * host to put the dump back into linear order, with -w 2 for
+ * 16-bit parts.
+ */
+static uint8_t gray_order;
+
+/** Swap the byte order that prom_fill() uses for 16-bit parts */
+static uint8_t swap_bytes;
+
+/** Extra settle time on top of the datasheet access time, in percent */
+#define ACCESS_MARGIN 50
+
+/** _delay_loop_2() iterations to wait between setting the address
+ * and sampling the data pins; computed from prom->access_ns.
+ */
+static uint16_t settle_loops;
+
+/** Largest number of samples for the majority vote read policy */
+#define READ_SAMPLES_MAX 9
+
+/** Read verification policy.
+ * 1 == single sample, 2 == resample until two consecutive reads agree,
+ * 3 to READ_SAMPLES_MAX == bitwise majority vote of that many samples.
+ */
+static uint8_t read_samples = 2;
+
+/** How often reads needed more than the minimum number of samples */
+typedef struct
+{
+	uint32_t reads;
+	uint32_t unstable;
+	uint32_t failed;
+} read_stats_t;
+
+static read_stats_t read_stats;
+
+/** Read routine for the selected chip, latch and read policy.
+ * Chosen by prom_reader_select() so that prom_read() does not test
+ * the chip options or the policy for every word.
+ */
+typedef uint16_t (*prom_reader_t)(uint32_t addr);
+
+static prom_reader_t prom_reader;
+
+/** Layout of a block for prom_fill(), as FILL_* flags */
+#define FILL_GRAY 1	//!< Visit the word addresses in Gray code order
+#define FILL_WIDE 2	//!< Two bytes per word, little endian
+#define FILL_BIG 4	//!< Two bytes per word, big endian
+
+/** Block fill routine for the same chip, latch and read policy, so
+ * that prom_fill() makes one indirect call per block, not per word.
+ */
+typedef void (*prom_filler_t)(
+	uint8_t * buf,
+	uint32_t addr,
+	uint16_t len,
+	uint8_t layout
+);
+
+static prom_filler_t prom_filler;
+
+/** Latch pin id for chips with OPTIONS_LATCH */
+static uint8_t latch_pin;
+
+static void
+prom_reader_select(void);
+
+/** Settle time measured by the calibrate command for one chip type.
+ * Only kept for this session; selecting another chip ignores it.
+ */
+static uint16_t calibrated_index = PROM_INDEX_NONE;
+static uint16_t calibrated_loops;
+
+/** Address lines that the capacity probe found populated, for one
+ * chip type.  Dumps stop at 2^probed_width words instead of reading
+ * the mirrors of a smaller chip in a larger footprint.
+ */
+static uint16_t probed_index = PROM_INDEX_NONE;
+static uint8_t probed_width;
+
+
+/** Chip definitions uploaded with the u commands are kept in EEPROM
+ * and numbered after the flash table, from proms_count up.
+ */
+#define USER_SLOTS 16
+
+/** First byte of a used slot.  Change it if prom_t changes, so that
+ * slots written by an older build read as empty.
+ */
+#define USER_SLOT_MAGIC 0xC2
+
+typedef struct
+{
+	uint8_t magic;
+	prom_t prom;
+} user_slot_t;
+
+static user_slot_t user_slots[USER_SLOTS] EEMEM;
+
+
+/** Mask of the package pins used in a list, or ~0 if a pin is
+ * not in the package or is listed twice.
+ */
+static uint64_t
+user_pin_mask(
+	const uint8_t * const pins,
+	const uint8_t count,
+	const uint8_t package
+)
+{
+	uint64_t mask = 0;
+	for (uint8_t i = 0 ; i < count ; i++)
+	{
+		const uint8_t pin = pins[i];
+		if (pin == 0)
+			continue;
+
+		const uint64_t bit = ((uint64_t) 1) << pin;
+		if (pin > package || (mask & bit))
+			return ~(uint64_t) 0;
+		mask |= bit;
+	}
+
+	return mask;
+}
+
+
+/** Check that a user definition fits the ZIF socket and the read path.
+ * \return NULL if it is usable, otherwise the reason it is not.
+ */
+static const __FlashStringHelper *
+user_check(
+	const prom_t * const p
+)
+{
+	if (p->name[0] == '\0')
+		return F("no name");
+	if (p->pins < 4 || p->pins > ZIF_PINS || (p->pins & 1))
+		return F("package must have an even number of pins up to 40");
+	if (p->options & ~(OPTIONS_PULLUPS | OPTIONS_LATCH | OPTIONS_BIG_ENDIAN))
+		return F("unknown options");
+	if (p->data_width == 0 || p->data_width > 16)
+		return F("needs 1 to 16 data pins");
+	if (p->addr_width > array_count(p->addr_pins)
+	||  p->vcc > p->pins
+	||  p->gnd > p->pins)
+		return F("pin out of range");
+	if ((p->options & OPTIONS_LATCH) && p->lo_pins[LATCH_PIN] == 0)
+		return F("latch needs the first lo pin");
+
+	// Every address and data line must be wired, once
+	for (uint8_t i = 0 ; i < p->addr_width ; i++)
+		if (p->addr_pins[i] == 0)
+			return F("missing address pin");
+	for (uint8_t i = 0 ; i < p->data_width ; i++)
+		if (p->data_pins[i] == 0)
+			return F("missing data pin");
+
+	const uint64_t masks[] = {
+		user_pin_mask(p->addr_pins, p->addr_width, p->pins),
+		user_pin_mask(p->data_pins, p->data_width, p->pins),
+		user_pin_mask(p->hi_pins, array_count(p->hi_pins), p->pins),
+		user_pin_mask(p->lo_pins, array_count(p->lo_pins), p->pins),
+	};
+
+	uint64_t used = 0;
+	for (uint8_t i = 0 ; i < array_count(masks) ; i++)
+	{
+		if (masks[i] == ~(uint64_t) 0 || (used & masks[i]))
+			return F("pin out of range or used twice");
+		used |= masks[i];
+	}
+
+	return NULL;
+}
+
+
+/** Copy entry index of the flash table or the user slots into p.
+ * \return 0 if it is an empty or damaged user slot.
+ */
+static uint8_t
+prom_fetch(
+	prom_t * const p,
+	const uint16_t index
+)
+{
+	if (index < proms_count)
+	{
+		memcpy_P(p, &proms[index], sizeof(*p));
+		return 1;
+	}
+
+	const uint16_t slot = index - proms_count;
+	if (slot >= USER_SLOTS
+	||  eeprom_read_byte(&user_slots[slot].magic) != USER_SLOT_MAGIC)
+		return 0;
+
+	eeprom_read_block(p, &user_slots[slot].prom, sizeof(*p));
+	return user_check(p) == NULL;
+}
+
+
+/** Copy an entry into prom_cache, falling back to NONE if it is an
+ * empty user slot.
+ */
+static void
+prom_load(
+	uint16_t index
+)
+{
+	if (!prom_fetch(&prom_cache, index))
+		prom_fetch(&prom_cache, index = 0);
+	prom_index = index;
+}
 
 
 /** Translate PROM pin numbers into ZIF pin numbers */
@@ -116,21 +362,40 @@ prom_pin(
 }
 
 
-/** Generate a 0.5 MHz clock on the XTAL pin to drive the chip
- * if it does not have a built in oscillator enabled.
+/** XTAL periods in each half of an SCK period, fastest first.
+ * SCK must stay below a quarter of the chip's clock, which is
+ * unknown if its fuses select the internal oscillator, so
+ * isp_setup() uses the fastest that the chip answers at.
+ */
+static const uint8_t isp_speeds[] = { 3, 12, 48, 192 };
+
+/** SCK half period in use, from isp_speeds[] */
+static uint8_t isp_half;
+
+/** Pin ids of the ISP lines, looked up once by isp_setup() */
+static uint8_t isp_mosi;
+static uint8_t isp_sck;
+static uint8_t isp_miso;
+static uint8_t isp_xtal;
+
+/** Extended address byte last loaded for flash beyond 128 KB */
+static uint8_t isp_ext;
+
+
+/** Run the chip for some XTAL periods, for when it does not have
+ * its built in oscillator enabled.  The pin is toggled by hand as
+ * fast as it will go; XTAL is on PE6 or PF1 for every ISP entry,
+ * neither of which is a timer output.
  */
 static void
 isp_clock(
 	uint8_t cycles
 )
 {
-	const uint8_t xtal = prom_pin(prom->addr_pins[ISP_XTAL]);
 	for (uint8_t i = 0 ; i < cycles ; i++)
 	{
-		out(xtal, 1);
-		_delay_us(1);
-		out(xtal, 0);
-		_delay_us(1);
+		out(isp_xtal, 1);
+		out(isp_xtal, 0);
 	}
 }
 
@@ -143,38 +408,54 @@ isp_write(
 	uint8_t byte
 )
 {
-	const uint8_t mosi = prom_pin(prom->addr_pins[ISP_MOSI]);
-	const uint8_t sck = prom_pin(prom->addr_pins[ISP_SCK]);
-	const uint8_t miso = prom_pin(prom->data_pins[ISP_MISO]);
 	uint8_t rc = 0;
 
 	for (uint8_t i = 0 ; i < 8 ; i++, byte <<= 1)
 	{
-		out(mosi, (byte & 0x80) ? 1 : 0);
-		isp_clock(4);
+		out(isp_mosi, (byte & 0x80) ? 1 : 0);
+		isp_clock(isp_half);
 
-		out(sck, 1);
-		isp_clock(4);
+		out(isp_sck, 1);
+		isp_clock(isp_half);
 
-		rc = (rc << 1) | (in(miso) ? 1 : 0);
-		out(sck, 0);
+		rc = (rc << 1) | (in(isp_miso) ? 1 : 0);
+		out(isp_sck, 0);
 	}
 
 	return rc;
 }
 
 
-/** Enter programming mode for an ISP chip.
- * \return 1 on success, 0 on failure.
+/** Send a four byte serial programming instruction.
+ * \return the byte read back during the last one.
  */
-static int
-isp_setup(void)
+static uint8_t
+isp_command(
+	const uint8_t op,
+	const uint8_t a,
+	const uint8_t b,
+	const uint8_t c
+)
+{
+	isp_write(op);
+	isp_write(a);
+	isp_write(b);
+	return isp_write(c);
+}
+
+
+/** Pulse RESET and send Programming Enable at the current SCK speed.
+ * rc gets the four bytes read back.
+ * \return 1 if the chip echoed it and has an Atmel signature.
+ */
+static uint8_t
+isp_enable(
+	const uint8_t reset,
+	uint8_t * const rc
+)
 {
 	// Pulse the RESET pin, while holding SCK low.
-	const uint8_t sck = prom_pin(prom->addr_pins[ISP_SCK]);
-	const uint8_t reset = prom_pin(prom->addr_pins[ISP_RESET]);
-	const uint8_t miso = prom_pin(prom->data_pins[ISP_MISO]);
-	out(sck, 0);
+	out(isp_sck, 0);
 	out(reset, 1);
 	isp_clock(4);
 	out(reset, 0);
@@ -183,32 +464,55 @@ isp_setup(void)
 	// Now delay at least 20 ms
 	_delay_ms(20);
 
-	uint8_t rc1, rc2, rc3, rc4;
-
 	// Enter programming mode; enable pull up on the MISO pin
-	out(miso, 1);
+	out(isp_miso, 1);
 
-	rc1 = isp_write(0xAC);
-	rc2 = isp_write(0x53);
-	rc3 = isp_write(0x12);
-	rc4 = isp_write(0x34);
+	rc[0] = isp_write(0xAC);
+	rc[1] = isp_write(0x53);
+	rc[2] = isp_write(0x12);
+	rc[3] = isp_write(0x34);
 
 	// Disable pull up
-	out(miso, 0);
+	out(isp_miso, 0);
 
-	if (rc3 == 0x53)
-		return 1;
+	// A garbled echo can still be 0x53 at the wrong speed,
+	// so check the first signature byte as well.
+	return rc[2] == 0x53 && isp_command(0x30, 0x00, 0x00, 0x00) == 0x1E;
+}
+
+
+/** Enter programming mode for an ISP chip.
+ * \return 1 on success, 0 on failure.
+ */
+static int
+isp_setup(void)
+{
+	isp_mosi = prom_pin(prom->addr_pins[ISP_MOSI]);
+	isp_sck = prom_pin(prom->addr_pins[ISP_SCK]);
+	isp_miso = prom_pin(prom->data_pins[ISP_MISO]);
+	isp_xtal = prom_pin(prom->addr_pins[ISP_XTAL]);
+	const uint8_t reset = prom_pin(prom->addr_pins[ISP_RESET]);
+
+	isp_ext = 0;
+
+	uint8_t rc[4];
+	for (uint8_t i = 0 ; i < array_count(isp_speeds) ; i++)
+	{
+		isp_half = isp_speeds[i];
+		if (isp_enable(reset, rc))
+			return 1;
+	}
 
-	// Now show what we read
+	// Nothing answered, so there is no point reading slowly
+	isp_half = isp_speeds[0];
+
+	// Now show what we read at the slowest speed
 	char buf[11];
-	buf[0] = hexdigit(rc1 >> 4);
-	buf[1] = hexdigit(rc1 >> 0);
-	buf[2] = hexdigit(rc2 >> 4);
-	buf[3] = hexdigit(rc2 >> 0);
-	buf[4] = hexdigit(rc3 >> 4);
-	buf[5] = hexdigit(rc3 >> 0);
-	buf[6] = hexdigit(rc4 >> 4);
-	buf[7] = hexdigit(rc4 >> 0);
+	for (uint8_t i = 0 ; i < 4 ; i++)
+	{
+		buf[2*i+0] = hexdigit(rc[i] >> 4);
+		buf[2*i+1] = hexdigit(rc[i] >> 0);
+	}
 	buf[8] = '\0';
 
 	Serial.println(buf);
@@ -216,28 +520,144 @@ isp_setup(void)
 }
 
 
+/** Bytes of signature, fuses, lock and calibration after the flash
+ * and EEPROM in an ISP dump.  Unused ones read as 0xFF.
+ */
+#define ISP_INFO_SIZE 16
+
+/** Instructions for each byte of the ISP info block */
+static const uint8_t isp_info[][3] PROGMEM = {
+	{ 0x30, 0x00, 0x00 },	// signature
+	{ 0x30, 0x00, 0x01 },
+	{ 0x30, 0x00, 0x02 },
+	{ 0x50, 0x00, 0x00 },	// low fuse
+	{ 0x58, 0x08, 0x00 },	// high fuse
+	{ 0x50, 0x08, 0x00 },	// extended fuse
+	{ 0x58, 0x00, 0x00 },	// lock bits
+	{ 0x38, 0x00, 0x00 },	// oscillator calibration
+	{ 0x38, 0x00, 0x01 },
+	{ 0x38, 0x00, 0x02 },
+	{ 0x38, 0x00, 0x03 },
+};
+
+
+/** Size of the EEPROM of an ISP chip in bytes */
+static uint32_t
+isp_eeprom_size(void)
+{
+	if (prom->eeprom_width == 0)
+		return 0;
+	return ((uint32_t) 1) << prom->eeprom_width;
+}
+
+
+/** Size of an ISP dump: flash, EEPROM, then the info block */
+static uint32_t
+isp_size(void)
+{
+	return (((uint32_t) 1) << prom->addr_width)
+		+ isp_eeprom_size()
+		+ ISP_INFO_SIZE;
+}
+
+
 /** Read a byte using the AVRISP, instead of the normal PROM format.
+ * addr is a byte offset into the dump laid out by isp_size(), with
+ * the flash in little endian word order as avrdude writes it.
  */
 static uint8_t
 isp_read(
 	uint32_t addr
 )
 {
-	uint8_t h = (addr >> 12) & 0x01;
-	uint8_t a = (addr >>  8) & 0x0F;
-	uint8_t b = (addr >>  0) & 0xFF;
-	isp_write(0x20 | (h ? 0x8 : 0));
-	isp_write(a);
-	isp_write(b);
-	return isp_write(0);
+	const uint32_t flash = ((uint32_t) 1) << prom->addr_width;
+	if (addr < flash)
+	{
+		const uint32_t word = addr >> 1;
+		const uint8_t ext = word >> 16;
+		if (ext != isp_ext)
+		{
+			isp_command(0x4D, 0x00, ext, 0x00);
+			isp_ext = ext;
+		}
+
+		return isp_command(addr & 1 ? 0x28 : 0x20, word >> 8, word, 0x00);
+	}
+	addr -= flash;
+
+	if (addr < isp_eeprom_size())
+		return isp_command(0xA0, addr >> 8, addr, 0x00);
+	addr -= isp_eeprom_size();
+
+	if (addr >= array_count(isp_info))
+		return 0xFF;
+
+	const uint8_t * const cmd = isp_info[addr];
+	return isp_command(
+		pgm_read_byte(&cmd[0]),
+		pgm_read_byte(&cmd[1]),
+		pgm_read_byte(&cmd[2]),
+		0x00
+	);
 }
 
 
 
+/** Convert an access time into _delay_loop_2() iterations,
+ * which take four cycles each, rounding up and adding the margin.
+ */
+static uint16_t
+prom_settle_loops(
+	uint16_t ns
+)
+{
+	if (ns == 0)
+		ns = DEFAULT_ACCESS_NS;
+
+	const uint32_t margin_ns = ((uint32_t) ns * (100 + ACCESS_MARGIN)) / 100;
+	const uint32_t cycles = (margin_ns * (F_CPU / 1000000) + 999) / 1000;
+	return (cycles + 3) / 4;
+}
+
+
+/** Build the pin plans and settle time for the selected PROM */
+static void
+prom_prepare(void)
+{
+	// Precompute the port writes for the address pins and the
+	// port reads for the data pins, so that neither
+	// prom_set_address() nor _prom_read() translate each pin.
+	if (prom->data_width != 0)
+	{
+		uint8_t addr_ids[array_count(prom->addr_pins)];
+		for (uint8_t i = 0 ; i < prom->addr_width ; i++)
+			addr_ids[i] = prom_pin(prom->addr_pins[i]);
+		addr_plan_build(&addr_plan, addr_ids, prom->addr_width);
+
+		uint8_t data_ids[array_count(prom->data_pins)];
+		for (uint8_t i = 0 ; i < prom->data_width ; i++)
+			data_ids[i] = prom_pin(prom->data_pins[i]);
+		data_plan_build(&data_plan, data_ids, prom->data_width);
+
+		latch_pin = prom_pin(prom->lo_pins[LATCH_PIN]);
+	}
+
+	prom_reader_select();
+
+	prom_addr = 0;
+	if (prom_index == calibrated_index)
+		settle_loops = calibrated_loops;
+	else
+		settle_loops = prom_settle_loops(prom->access_ns);
+}
+
+
 /** Configure all of the IO pins for the new PROM type */
 static void
 prom_setup(void)
 {
+	prom_prepare();
+
 	// Configure all of the address pins as outputs,
 	// pulled low for now
 	for (uint8_t i = 0 ; i < array_count(prom->addr_pins) ; i++)
@@ -285,7 +705,6 @@ prom_setup(void)
 		ddr(pin, 1);
 	}
 
-
 	// Let things stabilize for a little while
 	_delay_ms(250);
 
@@ -295,6 +714,39 @@ prom_setup(void)
 }
 
 
+/** Change to another PROM type that drives the same socket pins,
+ * without powering the chip down.  Only the address mapping and the
+ * levels of the hi and lo pins change.  Used by autoscan() to try
+ * each entry of a group after a single prom_setup().
+ */
+static void
+prom_switch(
+	const uint16_t index
+)
+{
+	prom_load(index);
+	prom_prepare();
+	addr_plan_write(&addr_plan, 0);
+
+	for (uint8_t i = 0 ; i < array_count(prom->lo_pins) ; i++)
+	{
+		uint8_t pin = prom_pin(prom->lo_pins[i]);
+		if (pin != 0)
+			out(pin, 0);
+	}
+
+	for (uint8_t i = 0 ; i < array_count(prom->hi_pins) ; i++)
+	{
+		uint8_t pin = prom_pin(prom->hi_pins[i]);
+		if (pin != 0)
+			out(pin, 1);
+	}
+
+	// Give a changed Vpp or chip enable a moment to settle
+	_delay_ms(1);
+}
+
+
 /** Switch all of the ZIF pins back to tri-state to make it safe.
  * Doesn't matter what PROM is inserted.
  */
@@ -309,47 +761,27 @@ prom_tristate(void)
 }
 
 
-/** Select a 32-bit address for the current PROM */
+/** Select a 32-bit address for the current PROM.
+ * Uses the plan built by prom_setup() and only rewrites the ports
+ * whose lines differ from the last address that was driven.
+ */
 static void
 prom_set_address(
 	uint32_t addr
 )
 {
-	for (uint8_t i = 0 ; i < prom->addr_width ; i++)
-	{
-		out(prom_pin(prom->addr_pins[i]), addr & 1);
-		addr >>= 1;
-	}
-}
-
-
-static uint8_t
-_prom_read(void)
-{
-	uint8_t b = 0;
-	for (uint8_t i = 0 ; i < prom->data_width  ; i++)
-	{
-		uint8_t bit = in(prom_pin(prom->data_pins[i])) ? 0x80 : 0;
-		b = (b >> 1) | bit;
-	}
-
-	return b;
+	addr_plan_step(&addr_plan, addr, prom_addr);
+	prom_addr = addr;
 }
 
 
-/** Read a byte from the PROM at the specified address..
- * \todo Update this to handle wider than 8-bit PROM chips.
- */
-static uint8_t
-prom_read(
+/** Drive an address, pulsing the latch pin if the chip needs it */
+static void
+prom_select(
 	uint32_t addr
 )
 {
-	if (prom->data_width == 0)
-		return isp_read(addr);
-
 	uint8_t latch = (prom->options & OPTIONS_LATCH) != 0;
-	uint8_t latch_pin = prom_pin(prom->lo_pins[LATCH_PIN]);
 	if (latch) {
 		out(latch_pin,1);
 	}
@@ -357,68 +789,790 @@ prom_read(
 	if (latch) {
 		out(latch_pin,0);
 	}
-	for(uint8_t i = 0 ; i < 255; i++)
-	{
-		asm("nop");
-		asm("nop");
-		asm("nop");
-		asm("nop");
-	}
+}
+
+
+/** Sample all of the data pins, data_pins[0] ending up in bit 0 */
+static inline uint16_t
+_prom_read(void)
+{
+	return data_plan_read(&data_plan);
+}
 
-	uint8_t old_r = _prom_read();
 
-	// Try reading a few times to be sure,
-	// or until the values converge
+/** Double-sample policy: keep reading until two consecutive
+ * samples agree, giving up after nine.
+ */
+static uint16_t
+prom_read_double(
+	uint16_t old_r
+)
+{
 	for (uint8_t i = 0 ; i < 8 ; i++)
 	{
-		uint8_t r = _prom_read();
+		uint16_t r = _prom_read();
 		if (r == old_r)
-			break;
+		{
+			if (i != 0)
+				read_stats.unstable++;
+			return r;
+		}
 		old_r = r;
 	}
 
+	read_stats.unstable++;
+	read_stats.failed++;
 	return old_r;
 }
 
 
-static uint8_t
-usb_serial_getchar_echo(void)
+/** Majority policy: take read_samples samples and vote on each bit.
+ * Addresses where the samples did not all agree count as unstable,
+ * and those where no single value won a majority count as failed.
+ */
+static uint16_t
+prom_read_majority(
+	const uint16_t first
+)
 {
-	while (1)
+	uint16_t samples[READ_SAMPLES_MAX];
+	uint16_t differ = 0;
+
+	samples[0] = first;
+	for (uint8_t i = 1 ; i < read_samples ; i++)
 	{
-		uint16_t c = Serial.read();
-		if (c == -1)
-			continue;
-		Serial.print((char) c);
-		return c;
+		samples[i] = _prom_read();
+		differ |= samples[i] ^ first;
+	}
+
+	if (differ == 0)
+		return first;
+
+	read_stats.unstable++;
+
+	uint16_t r = 0;
+	for (uint16_t bit = 1 ; bit != 0 ; bit <<= 1)
+	{
+		uint8_t ones = 0;
+		for (uint8_t i = 0 ; i < read_samples ; i++)
+			if (samples[i] & bit)
+				ones++;
+		if (ones > read_samples / 2)
+			r |= bit;
 	}
+
+	uint8_t votes = 0;
+	for (uint8_t i = 0 ; i < read_samples ; i++)
+		if (samples[i] == r)
+			votes++;
+	if (votes <= read_samples / 2)
+		read_stats.failed++;
+
+	return r;
 }
 
-static uint8_t
-hexdigit_parse(
-	uint8_t c
+
+/** Drive an address, wait for the chip's access time and take the
+ * first sample.  latch is a constant in every caller, so each of the
+ * readers below is compiled without the option test.
+ */
+static inline uint16_t
+prom_sample(
+	const uint32_t addr,
+	const uint8_t latch
 )
 {
-	if ('0' <= c && c <= '9')
-		return c - '0';
-	if ('A' <= c && c <= 'F')
-		return c - 'A' + 0xA;
-	if ('a' <= c && c <= 'f')
-		return c - 'a' + 0xA;
-	return 0xFF;
+	if (latch)
+		out(latch_pin, 1);
+	addr_plan_step(&addr_plan, addr, prom_addr);
+	prom_addr = addr;
+	if (latch)
+		out(latch_pin, 0);
+
+	// Wait for the chip's access time; _delay_loop_2(0) would
+	// be 65536 iterations, so skip it for very fast parts.
+	if (settle_loops)
+		_delay_loop_2(settle_loops);
+
+	read_stats.reads++;
+	return _prom_read();
 }
 
-static void
-hex32(
-	uint8_t * buf,
-	uint32_t addr
+
+static uint16_t
+prom_read_single(
+	const uint32_t addr
 )
 {
-	buf[7] = hexdigit(addr & 0xF); addr >>= 4;
-	buf[6] = hexdigit(addr & 0xF); addr >>= 4;
-	buf[5] = hexdigit(addr & 0xF); addr >>= 4;
-	buf[4] = hexdigit(addr & 0xF); addr >>= 4;
-	buf[3] = hexdigit(addr & 0xF); addr >>= 4;
+	return prom_sample(addr, 0);
+}
+
+
+static uint16_t
+prom_read_single_latch(
+	const uint32_t addr
+)
+{
+	return prom_sample(addr, 1);
+}
+
+
+static uint16_t
+prom_read_double_plain(
+	const uint32_t addr
+)
+{
+	return prom_read_double(prom_sample(addr, 0));
+}
+
+
+static uint16_t
+prom_read_double_latch(
+	const uint32_t addr
+)
+{
+	return prom_read_double(prom_sample(addr, 1));
+}
+
+
+static uint16_t
+prom_read_majority_plain(
+	const uint32_t addr
+)
+{
+	return prom_read_majority(prom_sample(addr, 0));
+}
+
+
+static uint16_t
+prom_read_majority_latch(
+	const uint32_t addr
+)
+{
+	return prom_read_majority(prom_sample(addr, 1));
+}
+
+
+static uint16_t
+prom_read_isp(
+	const uint32_t addr
+)
+{
+	return isp_read(addr);
+}
+
+
+/** Readers indexed by latch and by the read policy:
+ * single, double or majority.
+ */
+static const prom_reader_t prom_readers[2][3] = {
+	{ prom_read_single, prom_read_double_plain, prom_read_majority_plain },
+	{ prom_read_single_latch, prom_read_double_latch, prom_read_majority_latch },
+};
+
+
+/** Read len bytes from word address addr into buf.  latch and policy
+ * are constants in every caller, and each filler below passes a
+ * constant 0 layout for the usual byte wide linear dump, so that loop
+ * samples the pins directly with no call or option test per word.
+ */
+static inline void
+prom_fill_loop(
+	uint8_t * const buf,
+	uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout,
+	const uint8_t latch,
+	const uint8_t policy
+) __attribute__((__always_inline__));
+
+static inline void
+prom_fill_loop(
+	uint8_t * const buf,
+	uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout,
+	const uint8_t latch,
+	const uint8_t policy
+)
+{
+	const uint8_t gray = (layout & FILL_GRAY) != 0;
+	const uint8_t width = (layout & (FILL_WIDE | FILL_BIG)) ? 2 : 1;
+	const uint8_t hi = (layout & FILL_BIG) ? 0 : 1;
+
+	for (uint16_t off = 0 ; off < len ; off += width, addr++)
+	{
+		uint16_t w = prom_sample(gray ? addr ^ (addr >> 1) : addr, latch);
+		if (policy == 1)
+			w = prom_read_double(w);
+		else
+		if (policy == 2)
+			w = prom_read_majority(w);
+
+		if (width == 1)
+		{
+			buf[off] = w;
+		} else {
+			buf[off + 1 - hi] = w >> 0;
+			buf[off + hi] = w >> 8;
+		}
+	}
+}
+
+
+static void
+prom_fill_single(
+	uint8_t * const buf,
+	const uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout
+)
+{
+	if (layout == 0)
+		prom_fill_loop(buf, addr, len, 0, 0, 0);
+	else
+		prom_fill_loop(buf, addr, len, layout, 0, 0);
+}
+
+
+static void
+prom_fill_single_latch(
+	uint8_t * const buf,
+	const uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout
+)
+{
+	if (layout == 0)
+		prom_fill_loop(buf, addr, len, 0, 1, 0);
+	else
+		prom_fill_loop(buf, addr, len, layout, 1, 0);
+}
+
+
+static void
+prom_fill_double_plain(
+	uint8_t * const buf,
+	const uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout
+)
+{
+	if (layout == 0)
+		prom_fill_loop(buf, addr, len, 0, 0, 1);
+	else
+		prom_fill_loop(buf, addr, len, layout, 0, 1);
+}
+
+
+static void
+prom_fill_double_latch(
+	uint8_t * const buf,
+	const uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout
+)
+{
+	if (layout == 0)
+		prom_fill_loop(buf, addr, len, 0, 1, 1);
+	else
+		prom_fill_loop(buf, addr, len, layout, 1, 1);
+}
+
+
+static void
+prom_fill_majority_plain(
+	uint8_t * const buf,
+	const uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout
+)
+{
+	if (layout == 0)
+		prom_fill_loop(buf, addr, len, 0, 0, 2);
+	else
+		prom_fill_loop(buf, addr, len, layout, 0, 2);
+}
+
+
+static void
+prom_fill_majority_latch(
+	uint8_t * const buf,
+	const uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout
+)
+{
+	if (layout == 0)
+		prom_fill_loop(buf, addr, len, 0, 1, 2);
+	else
+		prom_fill_loop(buf, addr, len, layout, 1, 2);
+}
+
+
+/** ISP dumps are byte wide and always linear */
+static void
+prom_fill_isp(
+	uint8_t * const buf,
+	uint32_t addr,
+	const uint16_t len,
+	const uint8_t layout
+)
+{
+	(void) layout;
+	for (uint16_t off = 0 ; off < len ; off++)
+		buf[off] = isp_read(addr++);
+}
+
+
+/** Fillers indexed as prom_readers[] */
+static const prom_filler_t prom_fillers[2][3] = {
+	{ prom_fill_single, prom_fill_double_plain, prom_fill_majority_plain },
+	{ prom_fill_single_latch, prom_fill_double_latch, prom_fill_majority_latch },
+};
+
+
+/** Pick the read and fill routines for the selected chip and read policy */
+static void
+prom_reader_select(void)
+{
+	if (prom->data_width == 0)
+	{
+		prom_reader = prom_read_isp;
+		prom_filler = prom_fill_isp;
+		return;
+	}
+
+	const uint8_t latch = (prom->options & OPTIONS_LATCH) != 0;
+	const uint8_t policy = read_samples == 1 ? 0 : read_samples == 2 ? 1 : 2;
+	prom_reader = prom_readers[latch][policy];
+	prom_filler = prom_fillers[latch][policy];
+}
+
+
+/** Read a byte or word from the PROM at the specified address.
+ * Chips with more than 8 data pins return the whole word;
+ * see prom_fill() for turning those into bytes.
+ */
+static inline uint16_t
+prom_read(
+	uint32_t addr
+)
+{
+	return prom_reader(addr);
+}
+
+
+/** Number of bytes in each PROM word, 2 for 16-bit parts */
+static uint8_t
+prom_word_bytes(void)
+{
+	return prom->data_width > 8 ? 2 : 1;
+}
+
+
+/** Number of address lines to dump, after any capacity probe */
+static uint8_t
+prom_addr_width(void)
+{
+	if (prom_index == probed_index)
+		return probed_width;
+	return prom->addr_width;
+}
+
+
+/** Total size of the PROM image in bytes */
+static uint32_t
+prom_size(void)
+{
+	if (prom->data_width == 0)
+		return isp_size();
+	return (((uint32_t) 1) << prom_addr_width()) * prom_word_bytes();
+}
+
+
+/** Fill a buffer with the PROM image starting at byte offset pos.
+ * Wide parts are read one word per address and packed little endian,
+ * or big endian if the chip or the 'o' command asks for it.
+ * pos and len must be multiples of prom_word_bytes().
+ * \param gray Visit the word addresses in Gray code order.
+ * ISP dumps are not a power of two long and are always linear.
+ */
+static void
+prom_fill(
+	uint8_t * const buf,
+	uint32_t pos,
+	const uint16_t len,
+	const uint8_t gray
+)
+{
+	const uint8_t width = prom_word_bytes();
+	const uint8_t big = ((prom->options & OPTIONS_BIG_ENDIAN) != 0) ^ swap_bytes;
+
+	uint8_t layout = gray ? FILL_GRAY : 0;
+	if (width == 2)
+		layout |= big ? FILL_BIG : FILL_WIDE;
+
+	prom_filler(buf, pos / width, len, layout);
+}
+
+
+/** Read a single byte of the PROM image, for the interactive commands */
+static uint8_t
+prom_read_byte(
+	const uint32_t pos
+)
+{
+	uint8_t buf[2];
+	const uint8_t width = prom_word_bytes();
+	prom_fill(buf, pos - (pos % width), width, 0);
+	return buf[pos % width];
+}
+
+
+/** Number of addresses sampled by the calibrate command */
+#define CALIBRATE_SAMPLES 64
+
+/** Number of times each sample must read back identically */
+#define CALIBRATE_REPEATS 4
+
+/** Settle time used for the reference reads, about 110 usec,
+ * which is what the read loop used before per-chip access times.
+ */
+#define CALIBRATE_SAFE_LOOPS 450
+
+
+/** Address of one of the calibration samples, spread across the chip */
+static uint32_t
+calibrate_addr(
+	uint8_t i
+)
+{
+	const uint32_t size = ((uint32_t) 1) << prom->addr_width;
+	return ((size / CALIBRATE_SAMPLES) * i + i * 7) & (size - 1);
+}
+
+
+/** Check that every sample reads back as the reference value when
+ * the address is switched from its complement and given only
+ * loops iterations to settle.
+ * \return 1 if all of the reads agree, 0 otherwise.
+ */
+static uint8_t
+calibrate_pass(
+	const uint16_t * const ref,
+	uint16_t loops
+)
+{
+	const uint32_t mask = (((uint32_t) 1) << prom->addr_width) - 1;
+
+	for (uint8_t i = 0 ; i < CALIBRATE_SAMPLES ; i++)
+	{
+		const uint32_t addr = calibrate_addr(i);
+		for (uint8_t j = 0 ; j < CALIBRATE_REPEATS ; j++)
+		{
+			// Flip every address line so that the chip
+			// has to do a full access
+			prom_select(~addr & mask);
+			_delay_loop_2(CALIBRATE_SAFE_LOOPS);
+
+			prom_select(addr);
+			if (loops)
+				_delay_loop_2(loops);
+
+			if (_prom_read() != ref[i])
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/** Find the shortest settle time where repeated reads still agree,
+ * and use it plus a margin for this chip type for the rest of the
+ * session.
+ */
+static void
+prom_calibrate(void)
+{
+	if (prom->data_width == 0)
+	{
+		Serial.println(F("- ISP chips do not need calibration"));
+		return;
+	}
+
+	// Start from the datasheet time, not a previous calibration
+	calibrated_index = PROM_INDEX_NONE;
+	prom_setup();
+
+	uint16_t ref[CALIBRATE_SAMPLES];
+	for (uint8_t i = 0 ; i < CALIBRATE_SAMPLES ; i++)
+	{
+		prom_select(calibrate_addr(i));
+		_delay_loop_2(CALIBRATE_SAFE_LOOPS);
+		ref[i] = _prom_read();
+	}
+
+	uint16_t loops = settle_loops;
+	if (!calibrate_pass(ref, loops))
+	{
+		// Slower than the datasheet says, search upwards
+		while (1)
+		{
+			loops = loops * 2 + 1;
+			if (loops >= CALIBRATE_SAFE_LOOPS)
+			{
+				Serial.println(F("- Unstable reads, chip not calibrated"));
+				return;
+			}
+			if (calibrate_pass(ref, loops))
+				break;
+		}
+	} else {
+		// Walk down until the reads start to disagree
+		while (loops != 0 && calibrate_pass(ref, loops - 1))
+			loops--;
+	}
+
+	calibrated_index = prom_index;
+	calibrated_loops = loops + loops / 2 + 1;
+	settle_loops = calibrated_loops;
+
+	Serial.print(F("Settle "));
+	Serial.print(loops);
+	Serial.print(F(" loops, using "));
+	Serial.print(calibrated_loops);
+	Serial.print(F(" ("));
+	Serial.print(((uint32_t) calibrated_loops * 4000) / (F_CPU / 1000000));
+	Serial.print(F(" ns), datasheet "));
+	Serial.println(prom_settle_loops(prom->access_ns));
+}
+
+
+/** Addresses compared across each line by the capacity probe */
+#define PROBE_SAMPLES 24
+
+
+/** Address of one of the probe samples with line k clear.
+ * The first and last few words of the chip are always included,
+ * since code and vectors tend to sit there, and the rest are spread
+ * across the whole chip so that blank regions do not hide a line.
+ */
+static uint32_t
+probe_addr(
+	const uint8_t i,
+	const uint8_t k
+)
+{
+	const uint32_t mask = (((uint32_t) 1) << prom->addr_width) - 1;
+	uint32_t addr;
+	if (i < 8)
+		addr = i;
+	else
+	if (i < 16)
+		addr = mask - (i - 8);
+	else
+		addr = (i * 0x9E3779B1UL) >> 8;
+
+	return addr & mask & ~(((uint32_t) 1) << k);
+}
+
+
+/** Does setting address line k always read the same as leaving it
+ * clear?  Samples that are all one value, such as an erased region,
+ * are no evidence of a mirror and count as not aliased.
+ * seen is set if any two of the words read differed.
+ */
+static uint8_t
+probe_aliased(
+	const uint8_t k,
+	uint8_t * const seen
+)
+{
+	const uint32_t bit = ((uint32_t) 1) << k;
+	uint16_t first = 0;
+	uint8_t varied = 0;
+
+	for (uint8_t i = 0 ; i < PROBE_SAMPLES ; i++)
+	{
+		const uint32_t addr = probe_addr(i, k);
+		const uint16_t lo = prom_read(addr);
+		const uint16_t hi = prom_read(addr | bit);
+		if (lo != hi)
+		{
+			*seen = 1;
+			return 0;
+		}
+
+		if (i == 0)
+			first = lo;
+		else
+		if (lo != first)
+			varied = 1;
+	}
+
+	*seen |= varied;
+	return varied;
+}
+
+
+/** Find the populated capacity of the chip by testing each address
+ * line for aliasing.  The width is one more than the highest line
+ * that is not a mirror; aliased lines below that are reported since
+ * they point to a stuck or unconnected pin rather than a small chip.
+ * \return the number of populated address lines, or 0 if no sample
+ * varied, as for a blank chip or stuck data, and the capacity is
+ * unknown.
+ */
+static uint8_t
+prom_probe_width(void)
+{
+	uint8_t width = 0;
+	uint8_t seen = 0;
+	for (uint8_t k = 0 ; k < prom->addr_width ; k++)
+	{
+		if (!probe_aliased(k, &seen))
+		{
+			width = k + 1;
+			continue;
+		}
+
+		Serial.print(F("A"));
+		Serial.print(k);
+		Serial.println(F(" mirrors"));
+	}
+
+	return seen ? width : 0;
+}
+
+
+/** Probe the capacity and use it for the following dumps */
+static void
+prom_capacity(void)
+{
+	if (prom->data_width == 0)
+	{
+		Serial.println(F("- ISP chips have no address lines to probe"));
+		return;
+	}
+
+	prom_setup();
+	probed_index = PROM_INDEX_NONE;
+
+	const uint8_t width = prom_probe_width();
+	if (width == 0)
+	{
+		Serial.println(F("- No varying data, capacity unknown"));
+		return;
+	}
+
+	probed_index = prom_index;
+	probed_width = width;
+
+	Serial.print(F("Capacity "));
+	Serial.print(prom_size());
+	Serial.print(F(" bytes, "));
+	Serial.print(width);
+	Serial.print(F(" of "));
+	Serial.print(prom->addr_width);
+	Serial.println(F(" address lines"));
+}
+
+
+static uint8_t
+usb_serial_getchar_echo(void)
+{
+	while (1)
+	{
+		int c = Serial.read();
+		if (c == -1)
+			continue;
+		Serial.print((char) c);
+		return c;
+	}
+}
+
+static uint8_t
+hexdigit_parse(
+	uint8_t c
+)
+{
+	if ('0' <= c && c <= '9')
+		return c - '0';
+	if ('A' <= c && c <= 'F')
+		return c - 'A' + 0xA;
+	if ('a' <= c && c <= 'f')
+		return c - 'a' + 0xA;
+	return 0xFF;
+}
+
+/** Parse a hex number, skipping any spaces before it.
+ * \return the number of digits, or 0 if there was no number.
+ */
+static uint8_t
+hex_parse(
+	const char ** const p,
+	uint32_t * const value
+)
+{
+	while (**p == ' ')
+		(*p)++;
+
+	uint8_t digits = 0;
+	uint32_t x = 0;
+	while (1)
+	{
+		const uint8_t n = hexdigit_parse(**p);
+		if (n == 0xFF)
+			break;
+		x = (x << 4) | n;
+		digits++;
+		(*p)++;
+	}
+
+	if (digits)
+		*value = x;
+	return digits;
+}
+
+
+/** Parse a decimal number, skipping leading spaces, as hex_parse() */
+static uint8_t
+dec_parse(
+	const char ** const p,
+	uint32_t * const value
+)
+{
+	while (**p == ' ')
+		(*p)++;
+
+	uint8_t digits = 0;
+	uint32_t x = 0;
+	while ('0' <= **p && **p <= '9')
+	{
+		x = x * 10 + **p - '0';
+		digits++;
+		(*p)++;
+	}
+
+	if (digits)
+		*value = x;
+	return digits;
+}
+
+
+static void
+hex32(
+	char * buf,
+	uint32_t addr
+)
+{
+	buf[7] = hexdigit(addr & 0xF); addr >>= 4;
+	buf[6] = hexdigit(addr & 0xF); addr >>= 4;
+	buf[5] = hexdigit(addr & 0xF); addr >>= 4;
+	buf[4] = hexdigit(addr & 0xF); addr >>= 4;
+	buf[3] = hexdigit(addr & 0xF); addr >>= 4;
 	buf[2] = hexdigit(addr & 0xF); addr >>= 4;
 	buf[1] = hexdigit(addr & 0xF); addr >>= 4;
 	buf[0] = hexdigit(addr & 0xF); addr >>= 4;
@@ -426,225 +1580,1150 @@ hex32(
 
 
 static void
-hexdump(
-	uint32_t addr
-)
+hexdump(
+	uint32_t addr
+)
+{
+	char buf[80];
+	hex32(buf, addr);
+
+	for (int i = 0 ; i < 16 ; i++)
+	{
+		uint8_t w = prom_read_byte(addr++);
+		uint8_t x = 8 + i * 3;
+		buf[x+0] = ' ';
+		buf[x+1] = hexdigit(w >> 4);
+		buf[x+2] = hexdigit(w >> 0);
+
+		buf[8 + 16*3 + i + 2] = printable(w) ? w : '.';
+	}
+
+	buf[8 + 16 * 3 + 0] = ' ';
+	buf[8 + 16 * 3 + 1] = ' ';
+	buf[8 + 16 * 3 + 18] = '\r';
+	buf[8 + 16 * 3 + 19] = '\n';
+	buf[8 + 16 * 3 + 20] = '\0';
+
+	Serial.print(buf);
+}
+
+
+/** Read an address from the serial port, then read that from the PROM */
+static void
+read_addr(char* buffer)
+{
+	uint32_t addr = 0;
+	uint8_t buf_idx = 0;
+	while (1)
+	{
+	  uint8_t c = buffer[buf_idx++];
+	  if (c == '\0')
+	    break;
+	  uint8_t n = hexdigit_parse(c);
+	  if (n == 0xFF)
+	    goto error;
+	  
+	  addr = (addr << 4) | n;
+	}
+
+	Serial.println();
+
+	prom_setup();
+
+	for (uint8_t line = 0 ; line < 4 ; line++)
+	{
+		hexdump(addr);
+		addr += 16;
+	}
+	return;
+
+error:
+	Serial.println(F("?"));
+}
+
+
+/** Send a single prom name to the serial port */
+static void
+prom_list_send(
+	int mode,
+	const prom_t * const prom,
+	int selected
+)
+{
+	uint8_t buf[32];
+	uint8_t off = 0;
+	if (selected)
+	{
+		buf[off++] = '*';
+		buf[off++] = '*';
+		buf[off++] = '*';
+		buf[off++] = ' ';
+	}
+	// As many hex digits as the index needs, for a table past 0xFF
+	uint8_t shift = 0;
+	while (shift < 12 && (mode >> (shift + 4)) != 0)
+		shift += 4;
+	for ( ; ; shift -= 4)
+	{
+		buf[off++] = hexdigit(mode >> shift);
+		if (shift == 0)
+			break;
+	}
+	buf[off++] = ' ';
+	const uint8_t len = strnlen(prom->name, sizeof(prom->name));
+	memcpy(buf+off, prom->name, len);
+	off += len;
+	buf[off++] = '\r';
+	buf[off++] = '\n';
+	buf[off++] = '\0';
+
+	Serial.print(buf);
+}
+
+
+/** List all of the PROM models supported */
+static void
+prom_list(void)
+{
+	prom_t p;
+	for (uint16_t i = 0 ; i < proms_count + USER_SLOTS ; i++)
+	{
+		if (prom_fetch(&p, i))
+			prom_list_send(i, &p, i == prom_index);
+	}
+}
+
+static void
+prom_mode(char* buffer)
+{
+  prom_t p;
+  for (uint16_t i = 0; i < proms_count + USER_SLOTS; i++) {
+    if (!prom_fetch(&p, i))
+      continue;
+    const char* a = p.name;
+    const char* b = buffer;
+    char match = 1;
+    while (a < p.name + sizeof(p.name) && *a != '\0' && *b != '\0') {
+      if (*a != *b) { match = 0; break; }
+      a++; b++;
+    }
+    if (match) {
+	prom_load(i);
+	prom_list_send(i, prom, 1);
+	return;
+    }
+  }    
+  Serial.println(F("- No such chip"));
+}
+
+
+/** Definition being built by the u commands before it is saved */
+static prom_t user_edit;
+
+
+/** Parse a list of decimal package pins into pins[], clearing the
+ * rest of it.
+ * \return the number of pins, or 0xFF if the list does not fit.
+ */
+static uint8_t
+user_pins(
+	const char * buffer,
+	uint8_t * const pins,
+	const uint8_t max
+)
+{
+	memset(pins, 0, max);
+
+	uint8_t count = 0;
+	uint32_t pin;
+	while (dec_parse(&buffer, &pin))
+	{
+		if (count == max || pin > ZIF_PINS)
+			return 0xFF;
+		pins[count++] = pin;
+	}
+
+	return buffer[0] == '\0' ? count : 0xFF;
+}
+
+
+/** Print one pin list of the edited definition as its u command */
+static void
+user_show_pins(
+	const __FlashStringHelper * const cmd,
+	const uint8_t * const pins,
+	uint8_t count
+)
+{
+	while (count != 0 && pins[count-1] == 0)
+		count--;
+
+	Serial.print(cmd);
+	for (uint8_t i = 0 ; i < count ; i++)
+	{
+		Serial.print(' ');
+		Serial.print(pins[i]);
+	}
+	Serial.println();
+}
+
+
+/** Print the edited definition as the u commands that rebuild it */
+static void
+user_show(void)
+{
+	const prom_t * const p = &user_edit;
+	char name[sizeof(p->name) + 1];
+	memcpy(name, p->name, sizeof(p->name));
+	name[sizeof(p->name)] = '\0';
+
+	Serial.print(F("un "));
+	Serial.println(name);
+	Serial.print(F("up "));
+	Serial.println(p->pins);
+	Serial.print(F("uo "));
+	if (p->options >= 0x10)
+		Serial.print((char) hexdigit(p->options >> 4));
+	Serial.println((char) hexdigit(p->options));
+	user_show_pins(F("ua"), p->addr_pins, p->addr_width);
+	user_show_pins(F("ud"), p->data_pins, p->data_width);
+	user_show_pins(F("uh"), p->hi_pins, array_count(p->hi_pins));
+	user_show_pins(F("ul"), p->lo_pins, array_count(p->lo_pins));
+	Serial.print(F("ug "));
+	Serial.print(p->vcc);
+	Serial.print(' ');
+	Serial.println(p->gnd);
+	Serial.print(F("ut "));
+	Serial.println(p->access_ns);
+}
+
+
+/** Save the edited definition in a user slot, or erase the slot */
+static void
+user_save(
+	const char * buffer,
+	const uint8_t save
+)
+{
+	uint32_t slot;
+	if (!dec_parse(&buffer, &slot) || buffer[0] != '\0' || slot >= USER_SLOTS)
+	{
+		Serial.println(F("?"));
+		return;
+	}
+
+	if (save)
+	{
+		const __FlashStringHelper * const err = user_check(&user_edit);
+		if (err)
+		{
+			Serial.print(F("- "));
+			Serial.println(err);
+			return;
+		}
+	}
+
+	// Clear the magic first so a reset part way through the
+	// write leaves an empty slot rather than a damaged one.
+	user_slot_t * const s = &user_slots[slot];
+	eeprom_update_byte(&s->magic, 0xFF);
+
+	const uint16_t index = proms_count + slot;
+	if (calibrated_index == index)
+		calibrated_index = PROM_INDEX_NONE;
+	if (probed_index == index)
+		probed_index = PROM_INDEX_NONE;
+
+	if (save)
+	{
+		eeprom_update_block(&user_edit, &s->prom, sizeof(s->prom));
+		eeprom_update_byte(&s->magic, USER_SLOT_MAGIC);
+		prom_list_send(index, &user_edit, 0);
+	}
+
+	// Reload or drop the selected chip if it was in this slot
+	if (prom_index == index)
+		prom_load(index);
+}
+
+
+/** Build a chip definition a field at a time and keep it in EEPROM.
+ * Pins are decimal package pin numbers and lists are given in bit
+ * order, so "ua 10 9 8" puts A0 on pin 10.
+ */
+static void
+prom_user(
+	const char * buffer
+)
+{
+	prom_t * const p = &user_edit;
+	const char cmd = *buffer++;
+	uint32_t x = 0;
+	uint32_t y = 0;
+	uint8_t count = 0;
+
+	switch (cmd)
+	{
+	case '\0':
+		user_show();
+		return;
+
+	case 'n':
+	case 'c':
+		// A new definition is blank; a copy keeps its name
+		// unless one is given.
+		while (*buffer == ' ')
+			buffer++;
+		if (cmd == 'n' && *buffer == '\0')
+			break;
+		if (cmd == 'n')
+			memset(p, 0, sizeof(*p));
+		else
+			*p = *prom;
+		if (*buffer != '\0')
+		{
+			memset(p->name, 0, sizeof(p->name));
+			memcpy(p->name, buffer, strnlen(buffer, sizeof(p->name)));
+		}
+		return;
+
+	case 'p':
+		if (!dec_parse(&buffer, &x) || x > ZIF_PINS)
+			break;
+		p->pins = x;
+		return;
+
+	case 'o':
+		if (!hex_parse(&buffer, &x) || x > 0xFF)
+			break;
+		p->options = x;
+		return;
+
+	case 'a':
+		count = user_pins(buffer, p->addr_pins, sizeof(p->addr_pins));
+		if (count == 0xFF)
+			break;
+		p->addr_width = count;
+		return;
+
+	case 'd':
+		count = user_pins(buffer, p->data_pins, sizeof(p->data_pins));
+		if (count == 0xFF)
+			break;
+		p->data_width = count;
+		return;
+
+	case 'h':
+		if (user_pins(buffer, p->hi_pins, sizeof(p->hi_pins)) == 0xFF)
+			break;
+		return;
+
+	case 'l':
+		if (user_pins(buffer, p->lo_pins, sizeof(p->lo_pins)) == 0xFF)
+			break;
+		return;
+
+	case 'g':
+		if (!dec_parse(&buffer, &x) || !dec_parse(&buffer, &y)
+		||  x > ZIF_PINS || y > ZIF_PINS)
+			break;
+		p->vcc = x;
+		p->gnd = y;
+		return;
+
+	case 't':
+		if (!dec_parse(&buffer, &x) || x > 0xFFFF)
+			break;
+		p->access_ns = x;
+		return;
+
+	case 'w':
+		user_save(buffer, 1);
+		return;
+
+	case 'x':
+		user_save(buffer, 0);
+		return;
+	}
+
+	Serial.println(F("?"));
+}
+
+
+/** Entries that drive the same socket pins with no pin high in one
+ * and low in another are scanned as a group: the socket is powered
+ * once for the group and each entry is tried by prom_switch().
+ * autoscan() keeps one bit per entry for the groups, so entries
+ * past this many are not scanned.
+ */
+#define SCAN_PROMS_MAX 512
+
+/** Blocks of samples kept while scanning a group */
+#define SCAN_CACHE 2
+
+/** Words in each block, read from the low eight address lines */
+#define SCAN_BLOCK 256
+
+/** AVR ports A to F */
+#define SCAN_PORTS 6
+
+/** SCAN_BLOCK words read with every other output pin held at the
+ * levels in key.  Entries in a group share their low eight address
+ * pins, so any entry that puts the same levels on the rest of the
+ * socket would read the same data and can use the block instead.
+ */
+typedef struct
+{
+	uint8_t key[SCAN_PORTS];
+	uint8_t valid;
+	uint8_t stable;
+	uint16_t data[SCAN_BLOCK];
+} scan_block_t;
+
+/** Samples shared by the entries of a group.  About 1 KB, so it
+ * lives on autoscan()'s stack rather than in static SRAM.
+ */
+typedef struct
+{
+	scan_block_t block[SCAN_CACHE];
+	uint8_t oldest;
+
+	/** Output pins of the group other than the low address lines */
+	uint8_t static_pins[SCAN_PORTS];
+} scan_cache_t;
+
+
+/** Bit per package pin for a list of pins */
+static uint64_t
+scan_pin_mask(
+	const uint8_t * const pins,
+	const uint8_t count
+)
+{
+	uint64_t mask = 0;
+	for (uint8_t i = 0 ; i < count ; i++)
+		if (pins[i] != 0)
+			mask |= ((uint64_t) 1) << pins[i];
+	return mask;
+}
+
+
+/** Bit per package pin that the entry drives */
+static uint64_t
+scan_outputs(
+	const prom_t * const p
+)
+{
+	return scan_pin_mask(p->addr_pins, p->addr_width)
+		| scan_pin_mask(p->hi_pins, array_count(p->hi_pins))
+		| scan_pin_mask(p->lo_pins, array_count(p->lo_pins));
+}
+
+
+/** Can two entries be scanned with the socket powered once? */
+static uint8_t
+scan_compatible(
+	const prom_t * const a,
+	const prom_t * const b
+)
+{
+	if (a->pins != b->pins
+	||  a->options != b->options
+	||  a->data_width != b->data_width
+	||  a->addr_width < 8
+	||  b->addr_width < 8)
+		return 0;
+
+	if (memcmp(a->data_pins, b->data_pins, sizeof(a->data_pins)) != 0
+	||  memcmp(a->addr_pins, b->addr_pins, 8) != 0)
+		return 0;
+
+	if ((a->options & OPTIONS_LATCH)
+	&&  a->lo_pins[LATCH_PIN] != b->lo_pins[LATCH_PIN])
+		return 0;
+
+	const uint64_t a_hi = scan_pin_mask(a->hi_pins, array_count(a->hi_pins));
+	const uint64_t a_lo = scan_pin_mask(a->lo_pins, array_count(a->lo_pins));
+	const uint64_t b_hi = scan_pin_mask(b->hi_pins, array_count(b->hi_pins));
+	const uint64_t b_lo = scan_pin_mask(b->lo_pins, array_count(b->lo_pins));
+	if ((a_hi & b_lo) || (a_lo & b_hi))
+		return 0;
+
+	return scan_outputs(a) == scan_outputs(b);
+}
+
+
+/** Forget the cached blocks and note which pins make up the key
+ * for the group led by the selected PROM.
+ */
+static void
+scan_cache_reset(
+	scan_cache_t * const cache
+)
+{
+	memset(cache->static_pins, 0, sizeof(cache->static_pins));
+	for (uint8_t pin = 1 ; pin <= prom->pins ; pin++)
+	{
+		if ((scan_outputs(prom) & (((uint64_t) 1) << pin)) == 0)
+			continue;
+		if (memchr(prom->addr_pins, pin, 8))
+			continue;
+
+		const uint8_t id = prom_pin(pin);
+		cache->static_pins[((id >> 4) & 0xF) - 0xA] |= 1 << (id & 0x7);
+	}
+
+	for (uint8_t i = 0 ; i < SCAN_CACHE ; i++)
+		cache->block[i].valid = 0;
+	cache->oldest = 0;
+}
+
+
+/** Read the block at base, which must have the low eight bits clear,
+ * or find one read with the same pin levels by an earlier entry.
+ */
+static const scan_block_t *
+scan_block(
+	scan_cache_t * const cache,
+	const uint32_t base
+)
+{
+	prom_select(base);
+
+	uint8_t key[SCAN_PORTS];
+	for (uint8_t i = 0 ; i < SCAN_PORTS ; i++)
+		key[i] = port_read(0xA + i) & cache->static_pins[i];
+
+	for (uint8_t i = 0 ; i < SCAN_CACHE ; i++)
+	{
+		scan_block_t * const block = &cache->block[i];
+		if (!block->valid || memcmp(block->key, key, sizeof(key)) != 0)
+			continue;
+
+		cache->oldest = !i;
+		return block;
+	}
+
+	scan_block_t * const block = &cache->block[cache->oldest];
+	cache->oldest = !cache->oldest;
+
+	memcpy(block->key, key, sizeof(key));
+	block->valid = 1;
+	block->stable = 1;
+
+	for (uint16_t i = 0 ; i < SCAN_BLOCK ; i++)
+		block->data[i] = prom_read(base + i);
+
+	// reread and confirm
+	for (uint16_t i = 0 ; i < SCAN_BLOCK ; i++)
+	{
+		if (block->data[i] != prom_read(base + i))
+		{
+			block->stable = 0;
+			break;
+		}
+	}
+
+	return block;
+}
+
+
+/**
+ * Scan the current chip against the EPROM definition given.
+ * The socket must already be powered for a compatible entry.
+ * A "successful" scan should yield:
+ * - Different data on each data pin
+ * - Consistent data across multiple scans
+ * - A check on high memory to ensure to disambiguate different
+ *   memory grades on the same/similar pinouts
+ * Return 1 on success, 0 otherwise.
+ */
+static uint8_t
+scan(
+	scan_cache_t * const cache,
+	const uint16_t index
+)
+{
+	prom_switch(index);
+
+	// scan first 256 words for varying data
+	const scan_block_t * const low = scan_block(cache, 0);
+	if (!low->stable)
+		return 0;
+
+	const uint16_t data_mask = (((uint32_t) 1) << prom->data_width) - 1;
+	uint16_t zeros = 0;
+	uint16_t ones = 0;
+	for (uint16_t i = 0 ; i < SCAN_BLOCK ; i++)
+	{
+		zeros |= ~low->data[i] & data_mask;
+		ones |= low->data[i];
+	}
+
+	// ensure that we're not just getting the same bits again and again
+	if (ones != data_mask || zeros != data_mask)
+		return 0;
+
+	// check top half of memory. If first 256 bytes mirrors low memory
+	// or is the same byte, consider it a failure.
+	const uint32_t top_half_addr = (((uint32_t) 1) << prom->addr_width) >> 1;
+	const scan_block_t * const high = scan_block(cache, top_half_addr);
+	uint8_t same_byte_check = 1;
+	uint8_t same_data_check = 1;
+	for (uint16_t i = 0 ; i < SCAN_BLOCK ; i++)
+	{
+		if (high->data[i] != high->data[0])
+			same_byte_check = 0;
+		if (low->data[i] != high->data[i])
+			same_data_check = 0;
+	}
+
+	return !same_data_check && !same_byte_check;
+}
+
+
+/**
+ * Automatically scan all known EPROM types and attempt to construct
+ * a list of candidates.  Entries are grouped by scan_compatible()
+ * so that each group is powered up once, and entries in a group
+ * that put the same levels on the socket share their samples.
+ * ISP chips do not answer to parallel reads and are skipped.
+ */
+static void
+autoscan(void)
 {
-	char buf[80];
-	hex32(buf, addr);
+	prom_tristate();
 
-	for (int i = 0 ; i < 16 ; i++)
+	const uint16_t count = proms_count + USER_SLOTS < SCAN_PROMS_MAX
+		? proms_count + USER_SLOTS : SCAN_PROMS_MAX;
+
+	// Entries already in a group, and the members of the current one
+	uint8_t scanned[SCAN_PROMS_MAX / 8];
+	uint8_t group[SCAN_PROMS_MAX / 8];
+	memset(scanned, 0, sizeof(scanned));
+	scanned[0] = 1;
+
+	// Entries are streamed out of flash and EEPROM one at a time
+	prom_t lead;
+	prom_t p;
+	scan_cache_t cache;
+
+	for (uint16_t i = 1 ; i < count ; i++)
 	{
-		uint8_t w = prom_read(addr++);
-		uint8_t x = 8 + i * 3;
-		buf[x+0] = ' ';
-		buf[x+1] = hexdigit(w >> 4);
-		buf[x+2] = hexdigit(w >> 0);
+		if (scanned[i / 8] & (1 << (i % 8)))
+			continue;
+		if (!prom_fetch(&lead, i) || lead.data_width == 0)
+			continue;
 
-		buf[8 + 16*3 + i + 2] = printable(w) ? w : '.';
+		// Collect everything that can share the socket with i.
+		// Each entry matches the leader in every field but the
+		// hi and lo pins, so those are checked against the
+		// levels the whole group drives so far.
+		memset(group, 0, sizeof(group));
+		uint64_t group_hi = 0;
+		uint64_t group_lo = 0;
+		for (uint16_t j = i ; j < count ; j++)
+		{
+			const uint8_t bit = 1 << (j % 8);
+			if (scanned[j / 8] & bit)
+				continue;
+			if (!prom_fetch(&p, j)
+			||  p.data_width == 0
+			||  !scan_compatible(&lead, &p))
+				continue;
+
+			const uint64_t hi = scan_pin_mask(p.hi_pins, array_count(p.hi_pins));
+			const uint64_t lo = scan_pin_mask(p.lo_pins, array_count(p.lo_pins));
+			if ((hi & group_lo) || (lo & group_hi))
+				continue;
+
+			group_hi |= hi;
+			group_lo |= lo;
+			group[j / 8] |= bit;
+			scanned[j / 8] |= bit;
+		}
+
+		prom_load(i);
+		prom_setup();
+		scan_cache_reset(&cache);
+
+		for (uint16_t j = i ; j < count ; j++)
+		{
+			if ((group[j / 8] & (1 << (j % 8))) == 0)
+				continue;
+			if (!scan(&cache, j))
+				continue;
+			prom_list_send(j, prom, 1);
+
+			// The top half check only rules out the highest
+			// line; report any others that are mirrors.
+			const uint8_t width = prom_probe_width();
+			if (width != 0 && width < prom->addr_width)
+			{
+				Serial.print(F("    only "));
+				Serial.print(width);
+				Serial.println(F(" address lines populated"));
+			}
+		}
+
+		prom_tristate();
 	}
+}
 
-	buf[8 + 16 * 3 + 0] = ' ';
-	buf[8 + 16 * 3 + 1] = ' ';
-	buf[8 + 16 * 3 + 18] = '\r';
-	buf[8 + 16 * 3 + 19] = '\n';
-	buf[8 + 16 * 3 + 20] = '\0';
 
-	Serial.print(buf);
+/** Toggle the byte order for 16-bit parts */
+static void
+byte_order(void)
+{
+	swap_bytes = !swap_bytes;
+	const uint8_t big = ((prom->options & OPTIONS_BIG_ENDIAN) != 0) ^ swap_bytes;
+	Serial.println(big ? F("Big endian") : F("Little endian"));
 }
 
 
-/** Read an address from the serial port, then read that from the PROM */
+/** Report the read stability counters from the last dump */
 static void
-read_addr(char* buffer)
+read_stats_print(void)
+{
+	Serial.print(F("Policy "));
+	Serial.print(read_samples);
+	Serial.print(F(": "));
+	Serial.print(read_stats.reads);
+	Serial.print(F(" reads, "));
+	Serial.print(read_stats.unstable);
+	Serial.print(F(" unstable, "));
+	Serial.print(read_stats.failed);
+	Serial.println(F(" failed"));
+}
+
+
+/** Select the read verification policy, or show the current one */
+static void
+read_policy(
+	const char * buffer
+)
+{
+	if (buffer[0] != '\0')
+	{
+		const uint8_t n = hexdigit_parse(buffer[0]);
+		if (n == 0 || n > READ_SAMPLES_MAX)
+		{
+			Serial.println(F("?"));
+			return;
+		}
+		read_samples = n;
+		prom_reader_select();
+	}
+
+	read_stats_print();
+}
+
+
+/** Toggle Gray code ordering for the next dumps */
+static void
+gray_mode(void)
+{
+	gray_order = !gray_order;
+	Serial.println(gray_order ? F("Gray code order") : F("Linear order"));
+}
+
+
+static xmodem_t xmodem;
+
+/** Two transfer buffers, so that the next block can be read from
+ * the chip while the previous one waits for its ACK.
+ */
+static xmodem_block_t xmodem_blocks[2];
+
+/** Send the entire PROM memory via xmodem.
+ * \param start The receiver's NAK or 'C' that started the transfer.
+ */
+static void
+prom_send(
+	uint8_t start
+)
 {
+	if (xmodem_init(&xmodem, start) < 0)
+		return;
+
+	// Ending offset in bytes; wide parts take two per address
+	const uint32_t end_addr = prom_size() - 1;
+
+	// Bring the pins up to level
+	prom_setup();
+	memset(&read_stats, 0, sizeof(read_stats));
+
+	// Start sending!
 	uint32_t addr = 0;
-	uint8_t buf_idx = 0;
+	uint16_t size = xmodem.max_size;
+	uint8_t cur = 0;
 	while (1)
 	{
-	  uint8_t c = buffer[buf_idx++];
-	  if (c == '\0')
-	    break;
-	  uint8_t n = hexdigit_parse(c);
-	  if (n == 0xFF)
-	    goto error;
-	  
-	  addr = (addr << 4) | n;
+		xmodem_block_t * const block = &xmodem_blocks[cur];
+
+		// Use short blocks for the tail of small chips
+		if (end_addr + 1 - addr < size)
+			size = XMODEM_BLOCK_SHORT;
+		block->size = size;
+
+		// Fill this buffer while the other one is in flight,
+		// handling any ACK or NAK for it as we go.
+		for (uint16_t off = 0 ; off < size ; off += XMODEM_BLOCK_SHORT)
+		{
+			prom_fill(block->data + off, addr + off, XMODEM_BLOCK_SHORT, gray_order);
+			if (xmodem_poll(&xmodem) < 0)
+				return;
+		}
+		addr += size;
+
+		if (xmodem_wait(&xmodem) < 0)
+			return;
+		xmodem_queue(&xmodem, block);
+		cur = !cur;
+
+		// If we have wrapped the address, we are done
+		if (addr >= end_addr)
+			break;
 	}
 
-	Serial.println();
+	if (xmodem_wait(&xmodem) < 0)
+		return;
+
+	xmodem_fini(&xmodem);
+	read_stats_print();
+}
+
+
+/** bulk_fill_t callback to read the image in the selected order */
+static void
+prom_bulk_fill(
+	uint8_t * const buf,
+	const uint32_t pos,
+	const uint16_t len
+)
+{
+	prom_fill(buf, pos, len, gray_order);
+}
+
+
+/** Send the PROM memory with the windowed bulk protocol, PackBits
+ * compressing the frames if the command is "bz".  An optional hex
+ * start offset and length dump only part of it, so that the host can
+ * resume a transfer that failed.
+ */
+static void
+prom_bulk(
+	const char * buffer
+)
+{
+	const uint8_t packed = buffer[0] == 'z';
+	if (packed)
+		buffer++;
+
+	const uint32_t size = prom_size();
+	const uint8_t width = prom_word_bytes();
+	uint32_t start = 0;
+	uint32_t len = size;
+
+	if (hex_parse(&buffer, &start))
+	{
+		len = size - start;
+		hex_parse(&buffer, &len);
+	}
+
+	if (buffer[0] != '\0'
+	||  start > size
+	||  len > size - start
+	||  start % width != 0
+	||  len % width != 0)
+	{
+		Serial.println(F("?"));
+		return;
+	}
 
 	prom_setup();
+	memset(&read_stats, 0, sizeof(read_stats));
 
-	for (uint8_t line = 0 ; line < 4 ; line++)
+	const int32_t resent = bulk_send(start, len, prom_bulk_fill, packed);
+	if (resent < 0)
 	{
-		hexdump(addr);
-		addr += 16;
+		Serial.println(F("- Bulk transfer failed"));
+		return;
 	}
-	return;
 
-error:
-	Serial.println("?");
+	Serial.print(F("Resent "));
+	Serial.print(resent);
+	Serial.println(F(" frames"));
+	read_stats_print();
 }
 
 
-/** Send a single prom name to the serial port */
+/** bulk_fill_t callback for a verify, always in linear order */
 static void
-prom_list_send(
-	int mode,
-	const prom_t * const prom,
-	int selected
+prom_verify_fill(
+	uint8_t * const buf,
+	const uint32_t pos,
+	const uint16_t len
 )
 {
-	uint8_t buf[32];
-	uint8_t off = 0;
-	if (selected)
+	prom_fill(buf, pos, len, 0);
+}
+
+
+/** Compare the chip against an image that the host streams in bulk
+ * frames.  Only the differences are sent back, so a chip that
+ * matches costs one short ACK per frame.
+ */
+static void
+prom_verify(void)
+{
+	prom_setup();
+	memset(&read_stats, 0, sizeof(read_stats));
+
+	const int32_t rechecked = bulk_verify(prom_size(), prom_verify_fill);
+	if (rechecked < 0)
 	{
-		buf[off++] = '*';
-		buf[off++] = '*';
-		buf[off++] = '*';
-		buf[off++] = ' ';
+		Serial.println(F("- Verify failed"));
+		return;
 	}
-	if (mode >= 16) {
-	  buf[off++] = hexdigit(mode / 16);
+
+	Serial.print(F("Rechecked "));
+	Serial.print(rechecked);
+	Serial.println(F(" frames"));
+	read_stats_print();
+}
+
+
+
+/** Read the bytes at a list of addresses from the host, all in one
+ * powered session, for spot checks and fingerprinting.  The lists
+ * and the replies are bulk frames, so this needs a host tool.
+ */
+static void
+prom_batch(void)
+{
+	if (prom->data_width == 0)
+	{
+		Serial.println(F("- ISP chips can not be batch read"));
+		return;
 	}
-	buf[off++] = hexdigit(mode % 16);
-	buf[off++] = ' ';
-	memcpy(buf+off, prom->name, sizeof(prom->name));
-	off += sizeof(prom->name);
-	buf[off++] = '\r';
-	buf[off++] = '\n';
-	buf[off++] = '\0';
 
-	Serial.print(buf);
+	prom_setup();
+	memset(&read_stats, 0, sizeof(read_stats));
+
+	const int32_t resent = bulk_batch(prom_size(), prom_read_byte);
+	if (resent < 0)
+	{
+		Serial.println(F("- Batch read failed"));
+		return;
+	}
+
+	Serial.print(F("Resent "));
+	Serial.print(resent);
+	Serial.println(F(" lists"));
+	read_stats_print();
 }
 
 
-/** List all of the PROM models supported */
+/** Bytes covered by each line of sub-hashes from the hash command */
+#define HASH_SPAN 0x10000UL
+
+
+/** Print bytes as lower case hex, to compare against sha256sum */
 static void
-prom_list(void)
+hash_print(
+	const uint8_t * const p,
+	const uint8_t len
+)
 {
-	for (unsigned i = 0 ; i < proms_count ; i++)
+	char buf[3];
+	buf[2] = '\0';
+	for (uint8_t i = 0 ; i < len ; i++)
 	{
-		const prom_t * const p = &proms[i];
-		prom_list_send(i, p, p == prom );
+		buf[0] = "0123456789abcdef"[p[i] >> 4];
+		buf[1] = "0123456789abcdef"[p[i] & 0xF];
+		Serial.print(buf);
 	}
 }
 
+
+/** Finish the hashes for one part of the image and print them */
 static void
-prom_mode(char* buffer)
+hash_line(
+	const __FlashStringHelper * const label,
+	const uint32_t pos,
+	const uint32_t crc,
+	sha256_t * const sha
+)
 {
-  for (int i = 0; i < proms_count; i++) {
-    const char* a = proms[i].name;
-    const char* b = buffer;
-    char match = 1;
-    while (*a != '\0' && *b != '\0') {      
-      if (*a != *b) { match = 0; break; }
-      a++; b++;
-    }
-    if (match) {
-	prom = &proms[i];
-	prom_list_send(i, prom, 1);
-	return;
-    }
-  }    
-  Serial.println("- No such chip");
+	char addr[9];
+	hex32(addr, pos);
+	addr[8] = '\0';
+
+	uint8_t crc_bytes[4];
+	for (uint8_t i = 0 ; i < 4 ; i++)
+		crc_bytes[i] = crc >> (24 - 8 * i);
+
+	uint8_t digest[SHA256_DIGEST];
+	sha256_final(sha, digest);
+
+	Serial.print(label);
+	Serial.print(addr);
+	Serial.print(F(" crc32 "));
+	hash_print(crc_bytes, sizeof(crc_bytes));
+	Serial.print(F(" sha256 "));
+	hash_print(digest, sizeof(digest));
+	Serial.println();
 }
 
 
-/**
- * Scan the current chip against the EPROM definition given.
- * A "successful" scan should yield:
- * - Different data on each data pin
- * - Consistent data across multiple scans
- * - A check on high memory to ensure to disambiguate different
- *   memory grades on the same/similar pinouts
- * Return 1 on success, 0 otherwise.
+/** Hash the whole image on the device, in the same byte order as a
+ * dump, so that a chip can be checked against a known image without
+ * transferring it.  Chips larger than HASH_SPAN also get a line for
+ * each span, starting with its offset, to locate a difference.
  */
-static unsigned scan(const prom_t* use_prom) {
-  prom = use_prom;
-  prom_setup();
-  // scan first 256 bytes for varying data
-  uint8_t zeros = 0;
-  uint8_t ones = 0;
-  uint8_t block[16];
-  for (uint32_t addr = 0; addr < 256; addr += 16) {
-    for (uint8_t i = 0; i < 16; i++) {
-      block[i] = prom_read(addr+i);
-      zeros |= ~block[i];
-      ones |= block[i];
-    }
-    // reread and confirm
-    for (uint8_t i = 0; i < 16; i++) {
-      if (block[i] != prom_read(addr+i)) {
-	return 0;
-      }
-    }
-  }
-  // ensure that we're not just getting the same bits again and again
-  if (ones != 0xff || zeros != 0xff) { return 0; }
-  // check top half of memory. If first 256 bytes mirrors low memory
-  // or is the same byte, consider it a failure.
-  const uint32_t top_half_addr = (((uint32_t) 1) << prom->addr_width) >> 1;
-  uint8_t single_byte = prom_read(top_half_addr);
-  uint8_t same_byte_check = 1;
-  uint8_t same_data_check = 1;
-  for (uint8_t i = 0; i < 256; i++) {
-    uint8_t low = prom_read(i);
-    uint8_t high = prom_read(top_half_addr+i);
-    if (high != single_byte) { same_byte_check = 0; }
-    if (low != high) { same_data_check = 0; }
-  }
-  if (same_data_check || same_byte_check) { return 0; }
-  return 1;
+static void
+prom_hash(void)
+{
+	const uint32_t size = prom_size();
+	prom_setup();
+	memset(&read_stats, 0, sizeof(read_stats));
+
+	sha256_t total;
+	sha256_t span;
+	sha256_init(&total);
+	sha256_init(&span);
+	uint32_t total_crc = 0;
+	uint32_t span_crc = 0;
+	uint32_t span_start = 0;
+
+	uint8_t buf[256];
+	uint32_t pos = 0;
+	while (pos < size)
+	{
+		const uint16_t len = size - pos < sizeof(buf) ? size - pos : sizeof(buf);
+		prom_fill(buf, pos, len, 0);
+		pos += len;
+
+		total_crc = crc32_update(total_crc, buf, len);
+		sha256_update(&total, buf, len);
+		if (size <= HASH_SPAN)
+			continue;
+
+		span_crc = crc32_update(span_crc, buf, len);
+		sha256_update(&span, buf, len);
+		if (pos % HASH_SPAN != 0 && pos != size)
+			continue;
+
+		hash_line(F(""), span_start, span_crc, &span);
+		sha256_init(&span);
+		span_crc = 0;
+		span_start = pos;
+	}
+
+	hash_line(F("Total "), size, total_crc, &total);
+	read_stats_print();
 }
 
-/**
- * Automatically scan all known EPROM types and attempt to construct a list of candidates.
- */
-static void autoscan(void) {
-  prom_tristate();
-  for (int i = 0; i < proms_count; i++) {
-    if (scan(proms+i)) {
-      prom_list_send(i, prom, 1);
-    }
-    prom_tristate();
-  }
+
+/** Print a range of programmed bytes from the blank check */
+static void
+blank_range(
+	const uint32_t start,
+	const uint32_t end
+)
+{
+	char buf[18];
+	hex32(&buf[0], start);
+	buf[8] = '-';
+	hex32(&buf[9], end);
+	buf[17] = '\0';
+	Serial.println(buf);
 }
 
-static xmodem_block_t xmodem_block;
 
-/** Send the entire PROM memory via xmodem */
+/** Check that the chip is erased, with every data bit high, in one
+ * pass on the device.  Stops at the first programmed word unless
+ * the command is "ea", which lists every programmed range instead.
+ * Addresses are byte offsets in the image, as for the r command.
+ */
 static void
-prom_send(void)
+prom_blank(
+	const char * buffer
+)
 {
-	if (xmodem_init(&xmodem_block) < 0)
+	if (prom->data_width == 0)
+	{
+		Serial.println(F("- ISP chips can not be blank checked"));
 		return;
+	}
 
-	// Ending address
-	const uint32_t end_addr = (((uint32_t) 1) << prom->addr_width) - 1;
+	const uint8_t all = buffer[0] == 'a';
+	const uint8_t width = prom_word_bytes();
+	const uint16_t blank = (((uint32_t) 1) << prom->data_width) - 1;
+	const uint32_t words = ((uint32_t) 1) << prom_addr_width();
 
-	// Bring the pins up to level
 	prom_setup();
+	memset(&read_stats, 0, sizeof(read_stats));
 
-	// Start sending!
-	uint32_t addr = 0;
-	while (1)
+	uint32_t programmed = 0;
+	uint32_t ranges = 0;
+	uint32_t range_start = 0;
+	uint8_t in_range = 0;
+
+	for (uint32_t addr = 0 ; addr < words ; addr++)
 	{
-		for (uint8_t off = 0 ; off < sizeof(xmodem_block.data) ; off++)
-			xmodem_block.data[off] = prom_read(addr++);
+		const uint16_t w = prom_read(addr);
+		if (w == blank)
+		{
+			if (in_range)
+				blank_range(range_start, addr * width - 1);
+			in_range = 0;
+			continue;
+		}
 
-		if (xmodem_send(&xmodem_block) < 0)
+		if (!all)
+		{
+			// "aaaaaaaa: wwww" and the NUL
+			char buf[15];
+			hex32(buf, addr * width);
+			buf[8] = ':';
+			buf[9] = ' ';
+			for (uint8_t i = 0 ; i < 2 * width ; i++)
+				buf[10 + i] = hexdigit(w >> (4 * (2 * width - 1 - i)));
+			buf[10 + 2 * width] = '\0';
+			Serial.print(F("Programmed at "));
+			Serial.println(buf);
+			read_stats_print();
 			return;
+		}
 
-		// If we have wrapped the address, we are done
-		if (addr >= end_addr)
-			break;
+		programmed++;
+		if (!in_range)
+		{
+			in_range = 1;
+			range_start = addr * width;
+			ranges++;
+		}
 	}
 
-	xmodem_fini(&xmodem_block);
-}
+	if (in_range)
+		blank_range(range_start, words * width - 1);
 
+	if (programmed == 0)
+	{
+		Serial.print(F("Blank: "));
+		Serial.print(words * width);
+		Serial.println(F(" bytes"));
+	} else {
+		Serial.print(programmed * width);
+		Serial.print(F(" bytes programmed in "));
+		Serial.print(ranges);
+		Serial.println(F(" ranges"));
+	}
+
+	read_stats_print();
+}
 
 
 
@@ -653,9 +2732,10 @@ int main(void)
 	// Disable the ADC
 	ADMUX = 0;
 
+	prom_load(0);
 	Serial.begin(115200);
 
-	#define MAX_CMD 64
+	#define MAX_CMD 96
 	char buffer[MAX_CMD];
 	uint8_t buf_idx = 0;
 	while (1)
@@ -663,38 +2743,70 @@ int main(void)
 		// always put the PROM into tristate so that it is safe
 		// to swap the chips in between readings, and 
 		prom_tristate();
-		Serial.print("> ");
+		Serial.print(F("> "));
 
 		buf_idx = 0;
 		buffer[buf_idx] = 0;
 		while (1)
 		{
 		  // read in a line, processing on a newline, return, or
-		  // xmodem transfer nak
+		  // xmodem transfer nak or CRC request
 		  char c = usb_serial_getchar_echo();
 		  if (c == XMODEM_NAK) { buffer[0] = XMODEM_NAK; buf_idx=1; break; }
-		  if (c == '\n') { Serial.print("\r"); break; }
-		  if (c == '\r') { Serial.print("\n"); break; }
+		  if (c == XMODEM_C && buf_idx == 0) { buffer[0] = XMODEM_C; buf_idx=1; break; }
+		  if (c == '\n') { Serial.print(F("\r")); break; }
+		  if (c == '\r') { Serial.print(F("\n")); break; }
 		  if (buf_idx < (MAX_CMD-1)) buffer[buf_idx++] = c;
 		}
 		buffer[buf_idx] = 0;
 		// process command
 		switch(buffer[0]) {
-		case XMODEM_NAK: prom_send(); break;
+		case XMODEM_NAK: prom_send(XMODEM_NAK); break;
+		case XMODEM_C: prom_send(XMODEM_C); break;
+		case 'b': prom_bulk(buffer+1); break;
+		case 'v': prom_verify(); break;
+		case 'a': prom_batch(); break;
 		case 'r': read_addr(buffer+1); break;
 		case 'l': prom_list(); break;
 		case 'm': prom_mode(buffer+1); break;
+		case 'u': prom_user(buffer+1); break;
 		case 'i': isp_read(0); break;
 		case 's': autoscan(); break;
+		case 'g': gray_mode(); break;
+		case 'c': prom_calibrate(); break;
+		case 'z': prom_capacity(); break;
+		case 'h': prom_hash(); break;
+		case 'e': prom_blank(buffer+1); break;
+		case 'p': read_policy(buffer+1); break;
+		case 'o': byte_order(); break;
 		case '\n': break;
 		case '\r': break;
 		default:
-			Serial.print(
+			Serial.print(F(
 "r000000 Read a hex word from address\r\n"
 "l       List chip modes\r\n"
+"b       Bulk dump with the windowed protocol (use promdump on host)\r\n"
+"bz      Bulk dump with PackBits compressed frames (promdump -c)\r\n"
+"b S L   Bulk dump L bytes from offset S, both hex; also bz S L\r\n"
+"v       Verify against an image from the host (use promdump -v)\r\n"
+"a       Batch read a list of addresses from the host (promdump -a)\r\n"
 "mTYPE   Select chip TYPE\r\n"
+"u       Show the chip definition being edited, as u commands\r\n"
+"un NAME Start a new definition; uc [NAME] copies the selected chip\r\n"
+"up N    Package pins; uo HEX options; ut NS access time\r\n"
+"ua P..  Address pins from A0; ud data pins from D0 (decimal)\r\n"
+"uh P..  Pins driven high; ul pins driven low; ug VCC GND\r\n"
+"uw N    Save the definition in user slot N (0-15); ux N erases it\r\n"
 "s       Autoscan for chip type (POTENTIALLY DANGEROUS)\r\n"
-			);
+"g       Toggle Gray code dump order (gray-reorder, -w 2 for 16-bit)\r\n"
+"c       Calibrate the settle time for the inserted chip\r\n"
+"z       Probe the capacity and dump only the populated part\r\n"
+"h       Hash the whole chip: CRC-32 and SHA-256, and per 64 KB\r\n"
+"e       Blank check, stopping at the first programmed byte\r\n"
+"ea      Blank check, listing every range of programmed bytes\r\n"
+"pN      Read policy: 1 single, 2 double, 3-9 majority of N samples\r\n"
+"o       Toggle byte order for 16-bit chips\r\n"
+			));
 			break;
 		}
 	}
@@ -0,0 +1,188 @@
+/** \file SHA-256 with a rolling message schedule.
+ *
+ * The 64 round constants are read from flash on the AVR, and only
+ * 16 words of the schedule are kept, which keeps the stack use of a
+ * block down to about 100 bytes.
+ */
+#include <string.h>
+#include "sha256.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_dword(p) (*(p))
+#endif
+
+static const uint32_t sha256_k[64] PROGMEM = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+static inline uint32_t
+ror(
+	const uint32_t x,
+	const uint8_t n
+)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+
+static void
+sha256_block(
+	sha256_t * const ctx,
+	const uint8_t * const p
+)
+{
+	uint32_t w[16];
+	for (uint8_t i = 0 ; i < 16 ; i++)
+		w[i] = ((uint32_t) p[4*i+0] << 24)
+			| ((uint32_t) p[4*i+1] << 16)
+			| ((uint32_t) p[4*i+2] <<  8)
+			| ((uint32_t) p[4*i+3] <<  0);
+
+	uint32_t a = ctx->state[0];
+	uint32_t b = ctx->state[1];
+	uint32_t c = ctx->state[2];
+	uint32_t d = ctx->state[3];
+	uint32_t e = ctx->state[4];
+	uint32_t f = ctx->state[5];
+	uint32_t g = ctx->state[6];
+	uint32_t h = ctx->state[7];
+
+	for (uint8_t i = 0 ; i < 64 ; i++)
+	{
+		// Extend the schedule in place once the first 16 are used
+		if (i >= 16)
+		{
+			const uint32_t w15 = w[(i - 15) & 0xF];
+			const uint32_t w2 = w[(i - 2) & 0xF];
+			const uint32_t s0 = ror(w15, 7) ^ ror(w15, 18) ^ (w15 >> 3);
+			const uint32_t s1 = ror(w2, 17) ^ ror(w2, 19) ^ (w2 >> 10);
+			w[i & 0xF] += s0 + w[(i - 7) & 0xF] + s1;
+		}
+
+		const uint32_t s1 = ror(e, 6) ^ ror(e, 11) ^ ror(e, 25);
+		const uint32_t ch = (e & f) ^ (~e & g);
+		const uint32_t t1 = h + s1 + ch + pgm_read_dword(&sha256_k[i]) + w[i & 0xF];
+		const uint32_t s0 = ror(a, 2) ^ ror(a, 13) ^ ror(a, 22);
+		const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		const uint32_t t2 = s0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+	ctx->state[5] += f;
+	ctx->state[6] += g;
+	ctx->state[7] += h;
+}
+
+
+void
+sha256_init(
+	sha256_t * const ctx
+)
+{
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+	ctx->count = 0;
+}
+
+
+void
+sha256_update(
+	sha256_t * const ctx,
+	const void * const buf,
+	size_t len
+)
+{
+	const uint8_t * p = buf;
+
+	while (len)
+	{
+		const uint8_t off = ctx->count % SHA256_BLOCK;
+		size_t n = SHA256_BLOCK - off;
+		if (n > len)
+			n = len;
+
+		// Whole blocks are hashed straight from the caller's buffer
+		if (off == 0 && n == SHA256_BLOCK)
+		{
+			sha256_block(ctx, p);
+		} else {
+			memcpy(ctx->buf + off, p, n);
+			if (off + n == SHA256_BLOCK)
+				sha256_block(ctx, ctx->buf);
+		}
+
+		ctx->count += n;
+		p += n;
+		len -= n;
+	}
+}
+
+
+void
+sha256_final(
+	sha256_t * const ctx,
+	uint8_t * const digest
+)
+{
+	// Message length in bits, big endian, after the 0x80 and padding
+	const uint32_t bytes = ctx->count;
+	uint8_t len[8] = {
+		0, 0, 0, bytes >> 29,
+		bytes >> 21, bytes >> 13, bytes >> 5, bytes << 3,
+	};
+
+	const uint8_t pad = 0x80;
+	sha256_update(ctx, &pad, 1);
+
+	const uint8_t zero = 0;
+	while (ctx->count % SHA256_BLOCK != SHA256_BLOCK - sizeof(len))
+		sha256_update(ctx, &zero, 1);
+
+	sha256_update(ctx, len, sizeof(len));
+
+	for (uint8_t i = 0 ; i < 8 ; i++)
+	{
+		digest[4*i+0] = ctx->state[i] >> 24;
+		digest[4*i+1] = ctx->state[i] >> 16;
+		digest[4*i+2] = ctx->state[i] >>  8;
+		digest[4*i+3] = ctx->state[i] >>  0;
+	}
+}
@@ -0,0 +1,59 @@
+/** \file
+ * SHA-256 (FIPS 180-4).
+ *
+ * Small rather than fast: the round constants stay in flash on the
+ * AVR and the message schedule is computed in a 16 word window.
+ */
+#ifndef _prom_sha256_h_
+#define _prom_sha256_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_BLOCK 64
+#define SHA256_DIGEST 32
+
+typedef struct
+{
+	uint32_t state[8];
+
+	/** Total bytes hashed so far */
+	uint32_t count;
+
+	/** Partial block waiting for more data */
+	uint8_t buf[SHA256_BLOCK];
+} sha256_t;
+
+
+extern void
+sha256_init(
+	sha256_t * ctx
+);
+
+
+extern void
+sha256_update(
+	sha256_t * ctx,
+	const void * buf,
+	size_t len
+);
+
+
+/** Pad the message and write the digest.
+ * The context must be initialised again before it is reused.
+ */
+extern void
+sha256_final(
+	sha256_t * ctx,
+	uint8_t * digest
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -12,91 +12,180 @@
 #include <stdint.h>
 #include <string.h>
 //#include <util/delay.h>
+#include <util/crc16.h>
 #include "xmodem.h"
 
 
 
-/** Send a block.
- * Compute the checksum and complement.
- *
- * \return 0 if all is ok, -1 if a cancel is requested or more
- * than 10 retries occur.
+/** Write the pending block to the serial port */
+static void
+xmodem_transmit(
+	const xmodem_t * const x
+)
+{
+	const xmodem_block_t * const block = x->pending;
+
+	Serial.write((const uint8_t*) block, 3 + block->size);
+	Serial.write(block->cksum, x->crc ? 2 : 1);
+}
+
+
+/** Queue a block.
+ * Compute the checksum or CRC-16 and complement, then send it.
+ * The first block->size bytes of block->data are sent.
  */
-int
-xmodem_send(
+void
+xmodem_queue(
+	xmodem_t * const x,
 	xmodem_block_t * const block
 )
 {
-	// Compute the checksum and complement
-	uint8_t cksum = 0;
-	for (uint8_t i = 0 ; i < sizeof(block->data) ; i++)
-		cksum += block->data[i];
+	// Compute the checksum or CRC and complement
+	if (x->crc)
+	{
+		uint16_t crc = 0;
+		for (uint16_t i = 0 ; i < block->size ; i++)
+			crc = _crc_xmodem_update(crc, block->data[i]);
+
+		block->cksum[0] = crc >> 8;
+		block->cksum[1] = crc >> 0;
+	} else {
+		uint8_t cksum = 0;
+		for (uint16_t i = 0 ; i < block->size ; i++)
+			cksum += block->data[i];
+
+		block->cksum[0] = cksum;
+	}
 
-	block->cksum = cksum;
-	block->block_num++;
+	block->soh = block->size == XMODEM_BLOCK_SHORT ? XMODEM_SOH : XMODEM_STX;
+	block->block_num = ++x->block_num;
 	block->block_num_complement = 0xFF - block->block_num;
 
-	// Send the block, and wait for an ACK
-	uint8_t retry_count = 0;
+	x->pending = block;
+	x->retries = 0;
+	xmodem_transmit(x);
+}
+
 
-	while (retry_count++ < 10)
+/** Check for an ACK (done), CAN (abort) or NAK (retry).
+ * A NAK resends the pending block from its buffer.
+ *
+ * \return 1 if still pending, 0 if all is ok, -1 if a cancel is
+ * requested or more than XMODEM_RETRIES retries occur.
+ */
+int
+xmodem_poll(
+	xmodem_t * const x
+)
+{
+	while (x->pending)
 	{
-		Serial.write((void*) block, sizeof(*block));
+		int c = Serial.read();
+		if (c == -1)
+			return 1;
 
-		// Wait for an ACK (done), CAN (abort) or NAK (retry)
-		while (1)
+		if (c == XMODEM_ACK)
 		{
-			uint16_t c = Serial.read();
-			if (c == -1)
-				continue;
-			if (c == XMODEM_ACK)
-				return 0;
-			if (c == XMODEM_CAN)
-				return -1;
-			if (c == XMODEM_NAK)
-				break;
+			x->pending = NULL;
+			break;
 		}
+		if (c == XMODEM_CAN)
+			return -1;
+		if (c != XMODEM_NAK)
+			continue;
+
+		if (++x->retries >= XMODEM_RETRIES)
+			return -1;
+		xmodem_transmit(x);
 	}
 
-	// Failure or cancel
-	return -1;
+	return 0;
 }
 
 
 int
-xmodem_init(
+xmodem_wait(
+	xmodem_t * const x
+)
+{
+	while (1)
+	{
+		int rc = xmodem_poll(x);
+		if (rc <= 0)
+			return rc;
+	}
+}
+
+
+/** Send a block and wait for it.
+ *
+ * \return 0 if all is ok, -1 if a cancel is requested or more
+ * than 10 retries occur.
+ */
+int
+xmodem_send(
+	xmodem_t * const x,
 	xmodem_block_t * const block
 )
 {
-	block->soh = 0x01;
-	block->block_num = 0x00;
+	if (xmodem_wait(x) < 0)
+		return -1;
 
-	// wait for initial nak
+	xmodem_queue(x, block);
+	return xmodem_wait(x);
+}
+
+
+/** Negotiate the block format from the receiver's first character.
+ * 'C' selects XMODEM-1K with CRC-16, NAK the original 128 byte
+ * blocks with a checksum.
+ */
+int
+xmodem_init(
+	xmodem_t * const x,
+	uint8_t start
+)
+{
+	x->block_num = 0x00;
+	x->pending = NULL;
+
+	// wait for initial nak or 'C'
 	while (1)
 	{
-		uint16_t c = Serial.read();
+		int c = start;
+		start = 0;
+		if (c == 0)
+			c = Serial.read();
 		if (c == -1)
 			continue;
+
+		if (c == XMODEM_C)
+		{
+			x->crc = 1;
+			x->max_size = XMODEM_BLOCK_MAX;
+			break;
+		}
 		if (c == XMODEM_NAK)
-			return 0;
+		{
+			x->crc = 0;
+			x->max_size = XMODEM_BLOCK_SHORT;
+			break;
+		}
 		if (c == XMODEM_CAN)
 			return -1;
 	}
+
+	return 0;
 }
 
 
 int
 xmodem_fini(
-	xmodem_block_t * const block
+	xmodem_t * const x
 )
 {
-#if 0
-/* Don't send EOF?  rx adds it to the file? */
-	block->block_num++;
-	memset(block->data, XMODEM_EOF, sizeof(block->data));
-	if (xmodem_send_block(block) < 0)
-		return;
-#endif
+	// No EOF padding block; rx would keep it as part of the file
+	(void) x;
 
 	// File transmission complete.  send an EOT
 	// wait for an ACK or CAN
@@ -106,7 +195,7 @@ xmodem_fini(
 
 		while (1)
 		{
-			uint16_t c = Serial.read();
+			int c = Serial.read();
 			if (c == -1)
 				continue;
 			if (c == XMODEM_ACK)
@@ -1,5 +1,14 @@
 /** \file
  * xmodem file transfer protocol.
+ *
+ * Supports the original 128 byte blocks with an additive checksum,
+ * as well as XMODEM-1K with CRC-16 if the receiver starts with 'C'.
+ *
+ * Blocks can be sent without waiting for the acknowledgement so
+ * that the caller can fill the next block while the previous one is
+ * in flight: xmodem_queue() sends a block and returns, xmodem_poll()
+ * handles any ACK or NAK that has arrived and xmodem_wait() blocks
+ * until the outstanding block has been acknowledged.
  */
 #ifndef _xmodem_h_
 #define _xmodem_h_
@@ -7,18 +16,54 @@
 #include <avr/io.h>
 #include <stdint.h>
 
+/** Largest block that will be sent, used by XMODEM-1K */
+#define XMODEM_BLOCK_MAX 1024
+
+/** Block size for the original protocol and short final blocks */
+#define XMODEM_BLOCK_SHORT 128
+
+/** Number of times a block is resent before giving up */
+#define XMODEM_RETRIES 10
+
 
 typedef struct
 {
+	/** Header: XMODEM_SOH for 128 byte blocks, XMODEM_STX for 1K */
 	uint8_t soh;
 	uint8_t block_num;
 	uint8_t block_num_complement;
-	uint8_t data[128];
-	uint8_t cksum;
+	uint8_t data[XMODEM_BLOCK_MAX];
+
+	/** Checksum, or the CRC-16 high byte then low byte */
+	uint8_t cksum[2];
+
+	/** Size of the data in this block, at most xmodem_t.max_size */
+	uint16_t size;
 } __attribute__((__packed__))
 xmodem_block_t;
 
+
+/** State of one transfer */
+typedef struct
+{
+	/** Number of the last block queued */
+	uint8_t block_num;
+
+	/** Largest block size negotiated by xmodem_init() */
+	uint16_t max_size;
+
+	/** Non-zero if the receiver asked for CRC-16 */
+	uint8_t crc;
+
+	/** Block that has been sent but not yet acknowledged */
+	xmodem_block_t * pending;
+
+	/** Number of times the pending block has been resent */
+	uint8_t retries;
+} xmodem_t;
+
 #define XMODEM_SOH 0x01
+#define XMODEM_STX 0x02
 #define XMODEM_EOT 0x04
 #define XMODEM_ACK 0x06
 #define XMODEM_CAN 0x18
@@ -27,20 +72,54 @@ xmodem_block_t;
 #define XMODEM_EOF 0x1a
 
 
+/** Wait for the receiver to start the transfer.
+ * \param start The first character from the receiver if the caller
+ * has already read it, or 0 to wait for one.
+ */
 int
 xmodem_init(
+	xmodem_t * const x,
+	uint8_t start
+);
+
+
+/** Number and send a block without waiting for the ACK.
+ * Any previously queued block must have been acknowledged.
+ */
+void
+xmodem_queue(
+	xmodem_t * const x,
 	xmodem_block_t * const block
 );
 
 
+/** Process any response to the pending block.
+ * \return 1 if it is still waiting for an ACK, 0 if there is nothing
+ * outstanding, -1 on cancel or too many retries.
+ */
+int
+xmodem_poll(
+	xmodem_t * const x
+);
+
+
+/** Block until the pending block has been acknowledged */
+int
+xmodem_wait(
+	xmodem_t * const x
+);
+
+
+/** Send a block and wait for it to be acknowledged */
 int
 xmodem_send(
+	xmodem_t * const x,
 	xmodem_block_t * const block
 );
 
 
 int xmodem_fini(
-	xmodem_block_t * const block
+	xmodem_t * const x
 );
 
 
@@ -0,0 +1,103 @@
+/** \file
+ * Benchmark firmware for the simavr harness.
+ *
+ * The sketch is built unchanged for the at90usb1286 with its own
+ * main() renamed.  This main() reports the ZIF map to the harness,
+ * then selects each entry in proms[] in turn and brackets the read
+ * path functions with BENCH_START and BENCH_STOP, so the harness
+ * can count the exact cycles each one takes.
+ */
+#include <Arduino.h>
+#include "bench.h"
+
+#define main promdate_main
+#include "../../promdate/promdate.ino"
+#undef main
+
+
+static inline void
+bench_cmd(
+	const uint8_t cmd,
+	const uint8_t arg
+)
+{
+	BENCH_ARG = arg;
+	BENCH_CMD = cmd;
+}
+
+
+static void
+bench_parallel(void)
+{
+	prom_setup();
+
+	bench_cmd(BENCH_START, BENCH_FN_SET_ADDRESS);
+	for (uint16_t addr = 0 ; addr < BENCH_ADDRS ; addr++)
+		prom_set_address(addr);
+	bench_cmd(BENCH_STOP, 0);
+
+	bench_cmd(BENCH_START, BENCH_FN_READ);
+	for (uint16_t addr = 0 ; addr < BENCH_ADDRS ; addr++)
+		prom_read(addr);
+	bench_cmd(BENCH_STOP, 0);
+
+	xmodem_block_t * const block = &xmodem_blocks[0];
+	bench_cmd(BENCH_START, BENCH_FN_FILL);
+	prom_fill(block->data, 0, BENCH_BLOCK, 0);
+	bench_cmd(BENCH_STOP, 0);
+
+	xmodem_t x;
+	x.block_num = 0;
+	x.max_size = XMODEM_BLOCK_MAX;
+	x.crc = 1;
+	x.pending = NULL;
+	block->size = BENCH_BLOCK;
+
+	bench_cmd(BENCH_START, BENCH_FN_XMODEM);
+	xmodem_send(&x, block);
+	bench_cmd(BENCH_STOP, 0);
+
+	prom_tristate();
+}
+
+
+static void
+bench_isp(void)
+{
+	// There is no AVR in the virtual socket, so programming mode
+	// is not entered, but isp_read() takes the same time.
+	prom_setup();
+
+	bench_cmd(BENCH_START, BENCH_FN_ISP);
+	for (uint16_t addr = 0 ; addr < BENCH_ISP_ADDRS ; addr++)
+		isp_read(addr);
+	bench_cmd(BENCH_STOP, 0);
+
+	prom_tristate();
+}
+
+
+int
+main(void)
+{
+	// Disable the ADC
+	ADMUX = 0;
+
+	for (uint8_t i = 0 ; i < array_count(ports) ; i++)
+		bench_cmd(BENCH_PORT, ports[i]);
+
+	for (uint8_t i = 1 ; i < proms_count ; i++)
+	{
+		prom_load(i);
+		bench_cmd(BENCH_CHIP, i);
+
+		if (prom->data_width == 0)
+			bench_isp();
+		else
+			bench_parallel();
+	}
+
+	bench_cmd(BENCH_DONE, 0);
+	while (1)
+		;
+}
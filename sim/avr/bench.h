@@ -0,0 +1,43 @@
+/** \file
+ * Protocol between the benchmark firmware and the simavr harness.
+ *
+ * The firmware talks to the harness by writing to the general
+ * purpose IO registers, which cost one cycle and have no side
+ * effects on the real chip: BENCH_ARG first, then a command to
+ * BENCH_CMD, which the harness watches.
+ */
+#ifndef _sim_bench_h_
+#define _sim_bench_h_
+
+/** Data space addresses of GPIOR0 and GPIOR1 on the at90usb1286 */
+#define BENCH_CMD_ADDR 0x3E
+#define BENCH_ARG_ADDR 0x4A
+
+#ifdef __AVR__
+#include <avr/io.h>
+#define BENCH_CMD GPIOR0
+#define BENCH_ARG GPIOR1
+#endif
+
+/** Commands */
+#define BENCH_PORT 1	//!< ARG is the next entry of ports[]
+#define BENCH_CHIP 2	//!< ARG is the index in proms[] now selected
+#define BENCH_START 3	//!< ARG is the BENCH_FN_* being timed
+#define BENCH_STOP 4	//!< End of the timed section
+#define BENCH_CONSOLE 5	//!< ARG is a byte written to Serial
+#define BENCH_DONE 6	//!< All chips have been run
+
+/** Functions that are timed */
+#define BENCH_FN_SET_ADDRESS 0	//!< prom_set_address(), BENCH_ADDRS times
+#define BENCH_FN_READ 1		//!< prom_read(), BENCH_ADDRS times
+#define BENCH_FN_FILL 2		//!< prom_fill() of BENCH_BLOCK bytes
+#define BENCH_FN_XMODEM 3	//!< xmodem_send() of BENCH_BLOCK bytes
+#define BENCH_FN_ISP 4		//!< isp_read(), BENCH_ISP_ADDRS times
+#define BENCH_FNS 5
+
+/** Work done in each timed section */
+#define BENCH_ADDRS 256
+#define BENCH_BLOCK 1024
+#define BENCH_ISP_ADDRS 16
+
+#endif
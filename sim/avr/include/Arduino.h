@@ -0,0 +1,6 @@
+/** \file
+ * The benchmark firmware uses the same Serial stand-in as the host
+ * simulation, implemented in avr/serial.cpp, with avr-libc for
+ * everything else.
+ */
+#include "../../include/Arduino.h"
@@ -0,0 +1,110 @@
+/** \file Serial for the benchmark firmware under simavr.
+ *
+ * Output goes to the harness through the bench registers.  The
+ * harness plays a receiver that acknowledges everything, so reads
+ * always return an xmodem ACK.
+ */
+#include <Arduino.h>
+#include "xmodem.h"
+#include "bench.h"
+
+usb_serial_class Serial;
+
+
+int
+usb_serial_class::read(void)
+{
+	return XMODEM_ACK;
+}
+
+
+int
+usb_serial_class::available(void)
+{
+	return 1;
+}
+
+
+size_t
+usb_serial_class::write(
+	const uint8_t c
+)
+{
+	BENCH_ARG = c;
+	BENCH_CMD = BENCH_CONSOLE;
+	return 1;
+}
+
+
+size_t
+usb_serial_class::write(
+	const uint8_t * const buf,
+	const size_t len
+)
+{
+	for (size_t i = 0 ; i < len ; i++)
+		write(buf[i]);
+	return len;
+}
+
+
+void
+usb_serial_class::flush(void)
+{
+}
+
+
+size_t
+usb_serial_class::print(
+	const char * const s
+)
+{
+	return write((const uint8_t *) s, strlen(s));
+}
+
+
+size_t
+usb_serial_class::print(
+	const long x,
+	const int base
+)
+{
+	if (x < 0)
+		return print('-') + print((unsigned long) -x, base);
+	return print((unsigned long) x, base);
+}
+
+
+size_t
+usb_serial_class::print(
+	unsigned long x,
+	const int base
+)
+{
+	char buf[33];
+	char * p = &buf[sizeof(buf) - 1];
+	*p = '\0';
+
+	do {
+		const unsigned d = x % base;
+		*--p = d < 10 ? '0' + d : 'A' + d - 10;
+		x /= base;
+	} while (x);
+
+	return print(p);
+}
+
+
+/** Nothing waits on a timeout in the benchmark */
+unsigned long
+millis(void)
+{
+	return 0;
+}
+
+
+unsigned long
+micros(void)
+{
+	return 0;
+}
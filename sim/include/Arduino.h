@@ -0,0 +1,64 @@
+/** \file
+ * Stand-in for the Teensyduino core in the host simulation.
+ *
+ * Serial is connected to stdin/stdout or a pty by the simulator.
+ */
+#ifndef _sim_arduino_h_
+#define _sim_arduino_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+/** F() strings are in flash under simavr and ordinary strings on the
+ * host; the type is kept distinct so that a missing F() shows up as a
+ * build error here too.
+ */
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *) PSTR(s))
+
+class usb_serial_class
+{
+public:
+	void begin(long) {}
+
+	/** \return the next byte, or -1 if none is waiting */
+	int read(void);
+	int available(void);
+
+	size_t write(uint8_t c);
+	size_t write(const uint8_t * buf, size_t len);
+	void flush(void);
+
+	size_t print(const char * s);
+	size_t print(const uint8_t * s) { return print((const char *) s); }
+	size_t print(const __FlashStringHelper * s)
+	{
+		// Through pgm_read_byte(), since avr/bench.elf uses this too
+		const char * p = (const char *) s;
+		size_t n = 0;
+		for (char c ; (c = pgm_read_byte(p)) != '\0' ; p++)
+			n += write((uint8_t) c);
+		return n;
+	}
+	size_t print(char c) { return write((uint8_t) c); }
+	size_t print(long x, int base = 10);
+	size_t print(unsigned long x, int base = 10);
+	size_t print(int x, int base = 10) { return print((long) x, base); }
+	size_t print(unsigned x, int base = 10) { return print((unsigned long) x, base); }
+
+	size_t println(void) { return print("\r\n"); }
+	template <typename T>
+	size_t println(T x) { return print(x) + println(); }
+	template <typename T>
+	size_t println(T x, int base) { return print(x, base) + println(); }
+};
+
+extern usb_serial_class Serial;
+
+extern "C" unsigned long millis(void);
+extern "C" unsigned long micros(void);
+
+#endif
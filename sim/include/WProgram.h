@@ -0,0 +1,4 @@
+/** \file
+ * Old name for the Arduino core header.
+ */
+#include "Arduino.h"
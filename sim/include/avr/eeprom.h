@@ -0,0 +1,19 @@
+/** \file
+ * Stand-in for <avr/eeprom.h>: EEMEM variables are ordinary memory
+ * on the host, so they start zeroed rather than erased to 0xFF and
+ * are lost when the simulation exits.
+ */
+#ifndef _sim_avr_eeprom_h_
+#define _sim_avr_eeprom_h_
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_read_byte(p) (*(const uint8_t *)(p))
+#define eeprom_update_byte(p, v) (*(uint8_t *)(p) = (v))
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
+
+#endif
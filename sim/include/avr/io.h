@@ -0,0 +1,23 @@
+/** \file
+ * Stand-in for <avr/io.h> in the host simulation.
+ *
+ * The IO ports themselves are only reached through bits.h, which
+ * the simulation replaces, so only the registers the sketch touches
+ * directly are declared here.
+ */
+#ifndef _sim_avr_io_h_
+#define _sim_avr_io_h_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile uint8_t ADMUX;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
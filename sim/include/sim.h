@@ -0,0 +1,23 @@
+/** \file
+ * Hooks between the stub AVR headers and the simulated socket.
+ */
+#ifndef _sim_h_
+#define _sim_h_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Advance the virtual clock, in CPU cycles at F_CPU */
+extern void
+sim_delay_cycles(
+	uint32_t cycles
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+/** \file
+ * Stand-in for <util/crc16.h>, same results as the avr-libc versions.
+ */
+#ifndef _sim_util_crc16_h_
+#define _sim_util_crc16_h_
+
+#include <stdint.h>
+
+static inline uint16_t
+_crc_xmodem_update(
+	uint16_t crc,
+	uint8_t data
+)
+{
+	crc ^= (uint16_t) data << 8;
+	for (uint8_t i = 0 ; i < 8 ; i++)
+		crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	return crc;
+}
+
+#endif
@@ -0,0 +1,26 @@
+/** \file
+ * Stand-in for <util/delay.h> that advances the virtual clock.
+ */
+#ifndef _sim_util_delay_h_
+#define _sim_util_delay_h_
+
+#include "sim.h"
+
+static inline void
+_delay_us(
+	double us
+)
+{
+	sim_delay_cycles(us * (F_CPU / 1000000));
+}
+
+
+static inline void
+_delay_ms(
+	double ms
+)
+{
+	sim_delay_cycles(ms * (F_CPU / 1000));
+}
+
+#endif
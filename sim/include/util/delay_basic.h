@@ -0,0 +1,28 @@
+/** \file
+ * Stand-in for <util/delay_basic.h> that advances the virtual clock
+ * by the same number of cycles as the avr-libc loops.
+ */
+#ifndef _sim_util_delay_basic_h_
+#define _sim_util_delay_basic_h_
+
+#include <stdint.h>
+#include "sim.h"
+
+static inline void
+_delay_loop_1(
+	uint8_t count
+)
+{
+	sim_delay_cycles(3 * (count ? count : 256));
+}
+
+
+static inline void
+_delay_loop_2(
+	uint16_t count
+)
+{
+	sim_delay_cycles(4 * (count ? (uint32_t) count : 65536));
+}
+
+#endif
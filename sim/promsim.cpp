@@ -0,0 +1,364 @@
+/** \file
+ * Host simulation of the PROMdate with a virtual chip in the socket.
+ *
+ * The sketch is compiled for the host with stand-in AVR and Arduino
+ * headers, and bits.c is replaced by a model of the AVR ports that
+ * is wired through the sketch's ZIF map to a virtual chip.  This
+ * lets the read path be measured and regression tested without a
+ * board or a socketed chip.
+ *
+ * Usage: promsim [options] CHIP image.bin
+ *
+ * By default Serial is stdin/stdout, so the command set can be used
+ * by hand or from a script.  With -p it is a pty that promdump or
+ * rx can be pointed at.  With -r the whole chip is read once through
+ * prom_fill() and checked against the image.
+ */
+#include <Arduino.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include "socket.h"
+#include "serial.h"
+
+#define main promdate_main
+#include "../promdate/promdate.ino"
+#undef main
+
+
+/** Find a chip in proms[] by name.
+ * \return its index, or -1 if there is none.
+ */
+static int
+sim_find_chip(
+	const char * const name
+)
+{
+	for (unsigned i = 0 ; i < proms_count ; i++)
+		if (strncmp(proms[i].name, name, sizeof(proms[i].name)) == 0)
+			return i;
+	return -1;
+}
+
+
+static void
+sim_report(void)
+{
+	fprintf(stderr,
+		"promsim: %llu port ops, %llu samples, %llu accesses, %llu early, %llu cycles\n",
+		(unsigned long long) sim_stats.port_ops,
+		(unsigned long long) sim_stats.samples,
+		(unsigned long long) sim_stats.accesses,
+		(unsigned long long) sim_stats.early,
+		(unsigned long long) sim_stats.cycles
+	);
+}
+
+
+static void
+sim_exit(void)
+{
+	sim_report();
+	exit(EXIT_SUCCESS);
+}
+
+
+static void
+sim_signal(
+	int sig
+)
+{
+	(void) sig;
+	sim_exit();
+}
+
+
+/** Read the whole chip once and compare it with the image.
+ * In Gray order the dump is compared after putting each word back
+ * where it was read from, and written to out as read if it is set.
+ * \return the number of bytes that did not match.
+ */
+static uint32_t
+sim_read_all(
+	const uint8_t * const image,
+	const size_t image_size,
+	const char * const out
+)
+{
+	if (prom->data_width == 0)
+	{
+		fprintf(stderr, "promsim: %s is an ISP chip\n", prom->name);
+		exit(EXIT_FAILURE);
+	}
+
+	prom_setup();
+	memset(&sim_stats, 0, sizeof(sim_stats));
+	memset(&read_stats, 0, sizeof(read_stats));
+
+	const uint32_t size = prom_size();
+	uint8_t * const buf = (uint8_t *) malloc(size);
+	for (uint32_t pos = 0 ; pos < size ; pos += 0x8000)
+	{
+		const uint32_t len = size - pos < 0x8000 ? size - pos : 0x8000;
+		prom_fill(buf + pos, pos, len, gray_order);
+	}
+
+	if (out)
+	{
+		FILE * const f = fopen(out, "wb");
+		if (!f || fwrite(buf, 1, size, f) != size || fclose(f) != 0)
+		{
+			fprintf(stderr, "%s: %s\n", out, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	const uint8_t width = prom_word_bytes();
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0 ; i < size ; i++)
+	{
+		const uint32_t word = i / width;
+		const uint32_t addr = gray_order
+			? (word ^ (word >> 1)) * width + i % width
+			: i;
+		const uint8_t expected = addr < image_size ? image[addr] : 0xFF;
+		if (buf[i] == expected)
+			continue;
+		if (mismatches++ < 8)
+			fprintf(stderr, "%06x: expected %02x read %02x\n", i, expected, buf[i]);
+	}
+
+	const double cycles = (double) sim_stats.cycles / size;
+	printf("%s: %u bytes, %u mismatches, %.2f port ops/byte, %.1f cycles/byte, %.1f KB/s at %lu MHz\n",
+		prom->name,
+		size,
+		mismatches,
+		(double) sim_stats.port_ops / size,
+		cycles,
+		F_CPU / cycles / 1024,
+		F_CPU / 1000000
+	);
+	printf("%s: %llu early samples, read policy %u: %lu unstable, %lu failed\n",
+		prom->name,
+		(unsigned long long) sim_stats.early,
+		read_samples,
+		(unsigned long) read_stats.unstable,
+		(unsigned long) read_stats.failed
+	);
+
+	free(buf);
+	return mismatches;
+}
+
+
+/** Open a pty for Serial and tell the user where it is */
+static int
+sim_pty(void)
+{
+	const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0)
+	{
+		perror("posix_openpt");
+		exit(EXIT_FAILURE);
+	}
+
+	// Hold the other side open so that reads do not fail
+	// between clients, and keep it raw for binary transfers.
+	const int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+	struct termios t;
+	if (slave < 0 || tcgetattr(slave, &t) < 0)
+	{
+		perror(ptsname(fd));
+		exit(EXIT_FAILURE);
+	}
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fprintf(stderr, "promsim: serial on %s\n", ptsname(fd));
+	return fd;
+}
+
+
+/** Parse a stuck line, "a5=1" or "d3=0" */
+static int
+sim_parse_stuck(
+	sim_faults_t * const f,
+	const char * const arg
+)
+{
+	char type;
+	unsigned line, level;
+	if (sscanf(arg, "%c%u=%u", &type, &line, &level) != 3 || level > 1)
+		return -1;
+
+	if (type == 'a' && line < 24)
+	{
+		f->addr_stuck_mask |= ((uint32_t) 1) << line;
+		f->addr_stuck_value |= ((uint32_t) level) << line;
+		return 0;
+	}
+
+	if (type == 'd' && line < 16)
+	{
+		f->data_stuck_mask |= 1 << line;
+		f->data_stuck_value |= level << line;
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/** Parse a pair of shorted address lines, "3,4" */
+static int
+sim_parse_short(
+	sim_faults_t * const f,
+	const char * const arg
+)
+{
+	unsigned a, b;
+	if (sscanf(arg, "%u,%u", &a, &b) != 2 || a >= 24 || b >= 24)
+		return -1;
+	if (f->shorts >= SIM_SHORTS)
+		return -1;
+
+	f->short_a[f->shorts] = a;
+	f->short_b[f->shorts] = b;
+	f->shorts++;
+	return 0;
+}
+
+
+static void
+usage(
+	const char * const prog
+)
+{
+	fprintf(stderr,
+"Usage: %s [options] CHIP image.bin\n"
+"\n"
+"Options:\n"
+"    -r              Read the whole chip once, compare and report costs\n"
+"    -p              Connect Serial to a pty instead of stdin/stdout\n"
+"    -m NAME         Chip type selected in the sketch for -r (default CHIP)\n"
+"    -P N            Read policy for -r, as the pN command\n"
+"    -g              Read in Gray code order for -r, as the g command\n"
+"    -o FILE         Write the dump from -r to FILE\n"
+"    -a NS           Access time of the virtual chip\n"
+"    -f MASK         Data bits that float (hex)\n"
+"    -s a5=1|d3=0    Address or data line stuck at a level\n"
+"    -x A,B          Address lines A and B shorted together\n"
+"    -S SEED         Seed for floating and settling bits\n",
+		prog
+	);
+	exit(EXIT_FAILURE);
+}
+
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	sim_faults_t faults;
+	memset(&faults, 0, sizeof(faults));
+	uint32_t seed = 1;
+	int read_all = 0;
+	int use_pty = 0;
+	const char * select = NULL;
+	const char * out = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "rpm:P:go:a:f:s:x:S:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'r': read_all = 1; break;
+		case 'p': use_pty = 1; break;
+		case 'm': select = optarg; break;
+		case 'g': gray_order = 1; break;
+		case 'o': out = optarg; break;
+		case 'P':
+			read_samples = strtoul(optarg, NULL, 0);
+			if (read_samples == 0 || read_samples > READ_SAMPLES_MAX)
+				usage(argv[0]);
+			break;
+		case 'a': faults.access_ns = strtoul(optarg, NULL, 0); break;
+		case 'f': faults.floating = strtoul(optarg, NULL, 16); break;
+		case 's':
+			if (sim_parse_stuck(&faults, optarg) < 0)
+				usage(argv[0]);
+			break;
+		case 'x':
+			if (sim_parse_short(&faults, optarg) < 0)
+				usage(argv[0]);
+			break;
+		case 'S': seed = strtoul(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	const int chip_index = sim_find_chip(argv[optind]);
+	const prom_t * const chip = chip_index < 0 ? NULL : &proms[chip_index];
+	if (!chip || chip->data_width == 0)
+	{
+		fprintf(stderr, "%s: no model for this chip\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	FILE * const f = fopen(argv[optind+1], "rb");
+	if (!f)
+	{
+		fprintf(stderr, "%s: %s\n", argv[optind+1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	fseek(f, 0, SEEK_END);
+	const size_t image_size = ftell(f);
+	rewind(f);
+	uint8_t * const image = (uint8_t *) malloc(image_size + 1);
+	if (fread(image, 1, image_size, f) != image_size)
+	{
+		fprintf(stderr, "%s: short read\n", argv[optind+1]);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+
+	sim_socket_insert(ports, chip, image, image_size, &faults, seed);
+
+	if (read_all)
+	{
+		const int index = select ? sim_find_chip(select) : chip_index;
+		if (index < 0)
+		{
+			fprintf(stderr, "%s: unknown chip\n", select);
+			return EXIT_FAILURE;
+		}
+		prom_load(index);
+		return sim_read_all(image, image_size, out) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	signal(SIGINT, sim_signal);
+	signal(SIGTERM, sim_signal);
+
+	if (use_pty)
+	{
+		const int fd = sim_pty();
+		sim_serial_open(fd, fd, NULL);
+	} else {
+		fcntl(0, F_SETFL, O_NONBLOCK);
+		sim_serial_open(0, 1, sim_exit);
+	}
+
+	promdate_main();
+	return EXIT_SUCCESS;
+}
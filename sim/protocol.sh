@@ -0,0 +1,95 @@
+#!/bin/sh
+# Run host/promdump against promsim on a pty and check each bulk
+# protocol command: plain and compressed dumps, resume, verify with
+# and without differences or with an image of the wrong size, and
+# batch reads.
+#
+# Usage: protocol.sh promsim promdump
+set -e
+
+PROMSIM=$1
+PROMDUMP=$2
+CHIP=M27C512
+SIZE=65536
+
+dir=$(mktemp -d)
+sim_pid=
+cleanup()
+{
+	[ -n "$sim_pid" ] && kill $sim_pid 2>/dev/null
+	rm -rf "$dir"
+}
+trap cleanup EXIT
+
+fail()
+{
+	echo "protocol: $*" >&2
+	exit 1
+}
+
+# A random image with an erased tail, so that -c has runs to pack
+head -c 49152 /dev/urandom > "$dir/image.bin"
+head -c 16384 /dev/zero | tr '\0' '\377' >> "$dir/image.bin"
+
+"$PROMSIM" -p $CHIP "$dir/image.bin" 2> "$dir/sim.err" &
+sim_pid=$!
+
+pty=
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	pty=$(grep -o '/dev/pts/[0-9]*' "$dir/sim.err" || true)
+	[ -n "$pty" ] && break
+	sleep 0.2
+done
+[ -n "$pty" ] || fail "promsim did not open a pty"
+
+dump()
+{
+	"$PROMDUMP" -q -m $CHIP "$@" > "$dir/out.txt" 2> "$dir/err.txt"
+}
+
+# Plain and PackBits compressed dumps
+dump "$pty" "$dir/plain.bin" || fail "plain dump failed"
+cmp "$dir/plain.bin" "$dir/image.bin" || fail "plain dump differs"
+
+dump -c "$pty" "$dir/packed.bin" || fail "compressed dump failed"
+cmp "$dir/packed.bin" "$dir/image.bin" || fail "compressed dump differs"
+
+# Resume: claim the first 40 KB are done, but fill them with junk,
+# so a dump that did not resume from 40 KB would overwrite them.
+head -c 40960 /dev/urandom > "$dir/resume.bin"
+truncate -s $SIZE "$dir/resume.bin"
+echo "40960 $SIZE" > "$dir/resume.bin.resume"
+head -c 40960 "$dir/resume.bin" > "$dir/expected.bin"
+tail -c +40961 "$dir/image.bin" >> "$dir/expected.bin"
+dump -r "$pty" "$dir/resume.bin" || fail "resumed dump failed"
+cmp "$dir/resume.bin" "$dir/expected.bin" || fail "resumed dump differs"
+
+# Verify against the image, then against one with a byte changed
+dump -v "$dir/image.bin" "$pty" || fail "verify of a matching image failed"
+
+cp "$dir/image.bin" "$dir/golden.bin"
+printf '\125' | dd of="$dir/golden.bin" bs=1 seek=4660 conv=notrunc 2>/dev/null
+actual=$(od -An -tx1 -j 4660 -N1 "$dir/image.bin" | tr -d ' ')
+if dump -v "$dir/golden.bin" "$pty"; then
+	[ "$actual" = 55 ] || fail "verify missed a difference"
+else
+	grep -q "^001234: expected 55 read $actual\$" "$dir/out.txt" \
+		|| fail "verify did not list the difference"
+fi
+
+# An image of the wrong size fails even where it matches
+head -c 32768 "$dir/image.bin" > "$dir/short.bin"
+if dump -v "$dir/short.bin" "$pty"; then
+	fail "verify of a short image passed"
+fi
+
+# Batch read of single addresses and a strided span
+dump -a 0xfffc,0xfffd,0x10+0x1000*3 "$pty" || fail "batch read failed"
+: > "$dir/expected.txt"
+for addr in 16 4112 8208 65532 65533; do
+	byte=$(od -An -tx1 -j $addr -N1 "$dir/image.bin" | tr -d ' ')
+	printf '%06x: %s\n' $addr $byte >> "$dir/expected.txt"
+done
+sort "$dir/out.txt" | cmp - "$dir/expected.txt" || fail "batch read differs"
+
+echo "protocol: dump, -c, -r, -v and -a all match"
@@ -0,0 +1,173 @@
+/** \file Host implementation of the Teensyduino Serial object.
+ */
+#include <Arduino.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "serial.h"
+
+/** Empty reads in a row before backing off for a millisecond,
+ * so that the sketch's busy loops do not spin a host CPU.
+ */
+#define SIM_IDLE_READS 1000
+
+usb_serial_class Serial;
+
+static int serial_in = 0;
+static int serial_out = 1;
+static void (*serial_eof)(void);
+static unsigned idle_reads;
+
+
+void
+sim_serial_open(
+	const int in_fd,
+	const int out_fd,
+	void (* const on_eof)(void)
+)
+{
+	serial_in = in_fd;
+	serial_out = out_fd;
+	serial_eof = on_eof;
+}
+
+
+int
+usb_serial_class::read(void)
+{
+	uint8_t c;
+	const ssize_t n = ::read(serial_in, &c, 1);
+	if (n == 1)
+	{
+		idle_reads = 0;
+		return c;
+	}
+
+	if (n == 0 && serial_eof)
+		serial_eof();
+
+	if (++idle_reads >= SIM_IDLE_READS)
+	{
+		idle_reads = 0;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+
+int
+usb_serial_class::available(void)
+{
+	return 0;
+}
+
+
+size_t
+usb_serial_class::write(
+	const uint8_t c
+)
+{
+	return write(&c, 1);
+}
+
+
+size_t
+usb_serial_class::write(
+	const uint8_t * const buf,
+	const size_t len
+)
+{
+	size_t off = 0;
+	while (off < len)
+	{
+		const ssize_t n = ::write(serial_out, buf + off, len - off);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+			{
+				usleep(100);
+				continue;
+			}
+
+			// Nobody listening on the pty; drop it like the USB
+			// stack does when the host is not reading.
+			return len;
+		}
+		off += n;
+	}
+
+	return len;
+}
+
+
+void
+usb_serial_class::flush(void)
+{
+}
+
+
+size_t
+usb_serial_class::print(
+	const char * const s
+)
+{
+	return write((const uint8_t *) s, strlen(s));
+}
+
+
+size_t
+usb_serial_class::print(
+	const long x,
+	const int base
+)
+{
+	if (x < 0)
+		return print('-') + print((unsigned long) -x, base);
+	return print((unsigned long) x, base);
+}
+
+
+size_t
+usb_serial_class::print(
+	unsigned long x,
+	const int base
+)
+{
+	char buf[33];
+	char * p = &buf[sizeof(buf) - 1];
+	*p = '\0';
+
+	do {
+		const unsigned d = x % base;
+		*--p = d < 10 ? '0' + d : 'A' + d - 10;
+		x /= base;
+	} while (x);
+
+	return print(p);
+}
+
+
+static uint64_t
+sim_now_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+
+/** The protocol timeouts are against a real host, so use wall time */
+unsigned long
+millis(void)
+{
+	return sim_now_us() / 1000;
+}
+
+
+unsigned long
+micros(void)
+{
+	return sim_now_us();
+}
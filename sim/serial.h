@@ -0,0 +1,18 @@
+/** \file
+ * Connects the sketch's Serial to a pair of file descriptors.
+ */
+#ifndef _sim_serial_h_
+#define _sim_serial_h_
+
+/** Use in_fd and out_fd for Serial.
+ * \param on_eof Called when in_fd reaches end of file; if NULL,
+ * Serial.read() keeps returning -1 (a pty with no client).
+ */
+extern void
+sim_serial_open(
+	int in_fd,
+	int out_fd,
+	void (*on_eof)(void)
+);
+
+#endif
@@ -0,0 +1,309 @@
+/** \file
+ * Cycle-exact benchmark of the firmware under simavr.
+ *
+ * Usage: simbench [-v] avr/bench.elf
+ *
+ * Runs the benchmark firmware (avr/bench.cpp) on a simulated
+ * at90usb1286 with the virtual chip from socket.cpp wired to the
+ * AVR ports.  The firmware brackets each function with BENCH_START
+ * and BENCH_STOP and the harness reports the cycles taken per byte
+ * for every entry in proms[], along with the dump rate they imply.
+ *
+ * Unlike promsim -r, which estimates the cost of each call into
+ * bits.c, these are the cycles of the real avr-gcc output.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "socket.h"
+#include "avr/bench.h"
+
+#define BENCH_MCU "at90usb1286"
+
+/** Data space addresses of PINA; DDRx and PORTx follow each PINx */
+#define BENCH_PIN_ADDR 0x20
+
+/** Size of the random image in the virtual chip */
+#define BENCH_IMAGE (1 << 20)
+
+/** Longest a run may take before the firmware is assumed stuck */
+#define BENCH_MAX_CYCLES (600ULL * F_CPU)
+
+static avr_t * avr;
+static avr_irq_t * pin_irq[6];
+static int verbose;
+
+static uint8_t ports[41];
+static uint8_t ports_count;
+static uint8_t image[BENCH_IMAGE];
+
+static const prom_t * chip;
+static avr_cycle_count_t started;
+static uint8_t timing;
+static avr_cycle_count_t cycles[BENCH_FNS];
+static uint8_t done;
+
+/** Set while the harness itself is changing input pins */
+static uint8_t updating;
+
+
+/** Drive the PINx registers from the virtual chip */
+static void
+bench_inputs(void)
+{
+	if (updating)
+		return;
+	updating = 1;
+
+	sim_stats.cycles = avr->cycle;
+	for (uint8_t i = 0 ; i < 6 ; i++)
+	{
+		const uint8_t ddr = avr->data[BENCH_PIN_ADDR + 3 * i + 1];
+		const uint8_t value = sim_socket_pin(0xA + i);
+
+		for (uint8_t bit = 0 ; bit < 8 ; bit++)
+			if ((ddr & (1 << bit)) == 0)
+				avr_raise_irq(pin_irq[i] + bit, (value >> bit) & 1);
+	}
+
+	updating = 0;
+}
+
+
+/** Cycle timer for when the chip's outputs settle */
+static avr_cycle_count_t
+bench_settled(
+	avr_t * const avr,
+	const avr_cycle_count_t when,
+	void * const param
+)
+{
+	(void) avr;
+	(void) when;
+	(void) param;
+	bench_inputs();
+	return 0;
+}
+
+
+/** IRQ notify for changes to any DDRx or PORTx register */
+static void
+bench_port_changed(
+	avr_irq_t * const irq,
+	const uint32_t value,
+	void * const param
+)
+{
+	(void) irq;
+	(void) value;
+	(void) param;
+
+	if (updating)
+		return;
+
+	sim_stats.cycles = avr->cycle;
+	for (uint8_t i = 0 ; i < 6 ; i++)
+		sim_socket_port(0xA + i,
+			avr->data[BENCH_PIN_ADDR + 3 * i + 1],
+			avr->data[BENCH_PIN_ADDR + 3 * i + 2]
+		);
+
+	bench_inputs();
+
+	// Present the final data once the access time has passed
+	const uint64_t settled = sim_socket_settled();
+	if (settled > avr->cycle)
+		avr_cycle_timer_register(avr, settled - avr->cycle, bench_settled, NULL);
+}
+
+
+static void
+bench_report(
+	const prom_t * const p
+)
+{
+	const uint8_t word_bytes = p->data_width > 8 ? 2 : 1;
+	const double addr_bytes = BENCH_ADDRS * word_bytes;
+
+	if (p->data_width == 0)
+	{
+		printf("%-16s %10s %10s %10s %10s %10.1f %10.1f\n",
+			p->name, "-", "-", "-", "-",
+			(double) cycles[BENCH_FN_ISP] / BENCH_ISP_ADDRS,
+			F_CPU * (double) BENCH_ISP_ADDRS / cycles[BENCH_FN_ISP]
+		);
+		return;
+	}
+
+	const double fill = (double) cycles[BENCH_FN_FILL] / BENCH_BLOCK;
+	const double xmodem = (double) cycles[BENCH_FN_XMODEM] / BENCH_BLOCK;
+
+	printf("%-16s %10.1f %10.1f %10.1f %10.1f %10s %10.1f\n",
+		p->name,
+		cycles[BENCH_FN_SET_ADDRESS] / addr_bytes,
+		cycles[BENCH_FN_READ] / addr_bytes,
+		fill,
+		xmodem,
+		"-",
+		F_CPU / (fill + xmodem)
+	);
+}
+
+
+/** IO write handler for BENCH_CMD */
+static void
+bench_cmd(
+	avr_t * const avr,
+	const avr_io_addr_t addr,
+	const uint8_t cmd,
+	void * const param
+)
+{
+	(void) param;
+	avr->data[addr] = cmd;
+	const uint8_t arg = avr->data[BENCH_ARG_ADDR];
+
+	switch (cmd)
+	{
+	case BENCH_PORT:
+		if (ports_count < sizeof(ports))
+			ports[ports_count++] = arg;
+		break;
+
+	case BENCH_CHIP:
+	{
+		if (chip)
+			bench_report(chip);
+		chip = &proms[arg];
+		memset(cycles, 0, sizeof(cycles));
+
+		// No faults, and an empty socket for the ISP chips
+		sim_faults_t faults;
+		memset(&faults, 0, sizeof(faults));
+		sim_socket_insert(ports, chip->data_width ? chip : NULL,
+			image, sizeof(image), &faults, 1);
+		bench_port_changed(NULL, 0, NULL);
+		break;
+	}
+
+	case BENCH_START:
+		timing = arg < BENCH_FNS ? arg : 0;
+		started = avr->cycle;
+		break;
+
+	case BENCH_STOP:
+		cycles[timing] += avr->cycle - started;
+		break;
+
+	case BENCH_CONSOLE:
+		if (verbose)
+			fputc(arg, stderr);
+		break;
+
+	case BENCH_DONE:
+		if (chip)
+			bench_report(chip);
+		done = 1;
+		break;
+	}
+}
+
+
+static void
+usage(
+	const char * const prog
+)
+{
+	fprintf(stderr,
+"Usage: %s [-v] bench.elf\n"
+"\n"
+"    -v     Show the firmware's serial output on stderr\n",
+		prog
+	);
+	exit(EXIT_FAILURE);
+}
+
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "v")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 1)
+		usage(argv[0]);
+
+	elf_firmware_t fw;
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[optind], &fw) != 0)
+	{
+		fprintf(stderr, "%s: unable to load firmware\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	avr = avr_make_mcu_by_name(BENCH_MCU);
+	if (!avr)
+	{
+		fprintf(stderr, "simavr has no %s model\n", BENCH_MCU);
+		return EXIT_FAILURE;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = F_CPU;
+
+	srand(1);
+	for (size_t i = 0 ; i < sizeof(image) ; i++)
+		image[i] = rand();
+
+	avr_register_io_write(avr, BENCH_CMD_ADDR, bench_cmd, NULL);
+
+	for (uint8_t i = 0 ; i < 6 ; i++)
+	{
+		const uint32_t ioctl = AVR_IOCTL_IOPORT_GETIRQ('A' + i);
+		pin_irq[i] = avr_io_getirq(avr, ioctl, IOPORT_IRQ_PIN0);
+		avr_irq_register_notify(
+			avr_io_getirq(avr, ioctl, IOPORT_IRQ_PIN_ALL),
+			bench_port_changed, NULL);
+		avr_irq_register_notify(
+			avr_io_getirq(avr, ioctl, IOPORT_IRQ_DIRECTION_ALL),
+			bench_port_changed, NULL);
+	}
+
+	printf("%-16s %10s %10s %10s %10s %10s %10s\n",
+		"cycles/byte", "set_addr", "prom_read", "prom_fill", "xmodem", "isp_read", "bytes/s");
+
+	while (!done)
+	{
+		const int state = avr_run(avr);
+		if (state == cpu_Done || state == cpu_Crashed)
+		{
+			fprintf(stderr, "firmware stopped at cycle %llu\n",
+				(unsigned long long) avr->cycle);
+			return EXIT_FAILURE;
+		}
+
+		if (avr->cycle > BENCH_MAX_CYCLES)
+		{
+			fprintf(stderr, "firmware did not finish\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,423 @@
+/** \file Simulated AVR ports and virtual ZIF socket chip.
+ */
+#include <string.h>
+#include "sim.h"
+#include "bits.h"
+#include "socket.h"
+
+/** Number of pins on the ZIF socket, as in promdate.ino */
+#define SIM_ZIF_PINS 40
+
+sim_stats_t sim_stats;
+volatile uint8_t ADMUX;
+
+static uint8_t sim_ddr[6];
+static uint8_t sim_port[6];
+
+/** The inserted chip and its pins translated to AVR pin ids */
+static struct
+{
+	const prom_t * prom;
+	const uint8_t * image;
+	size_t image_size;
+	sim_faults_t faults;
+	uint32_t access_cycles;
+
+	uint8_t addr_id[24];
+	uint8_t data_id[24];
+	uint8_t hi_id[8];
+	uint8_t lo_id[8];
+	uint8_t latch_id;
+
+	/** Address the chip is decoding, after the latch if it has one */
+	uint32_t addr;
+	uint32_t latched;
+	uint8_t latch_level;
+
+	/** When the address last changed and what was on the outputs */
+	uint64_t changed_at;
+	uint16_t old_data;
+
+	/** Last address that was sampled, for counting accesses */
+	uint32_t sampled;
+} chip;
+
+static uint32_t rng = 1;
+
+
+static uint32_t
+sim_random(void)
+{
+	// xorshift32
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+
+void
+sim_delay_cycles(
+	const uint32_t cycles
+)
+{
+	sim_stats.cycles += cycles;
+}
+
+
+/** Level of an AVR pin as the chip sees it */
+static uint8_t
+sim_level(
+	const uint8_t id
+)
+{
+	const uint8_t port = ((id >> 4) & 0xF) - 0xA;
+	const uint8_t bit = 1 << (id & 0x7);
+
+	if (port >= 6)
+		return sim_random() & 1;
+	if (sim_ddr[port] & bit)
+		return (sim_port[port] & bit) != 0;
+
+	// Pulled up, or left floating
+	if (sim_port[port] & bit)
+		return 1;
+	return sim_random() & 1;
+}
+
+
+/** Contents of the chip at an address */
+static uint16_t
+sim_data(
+	uint32_t addr
+)
+{
+	const prom_t * const p = chip.prom;
+	addr &= (((uint32_t) 1) << p->addr_width) - 1;
+
+	if (p->data_width <= 8)
+		return addr < chip.image_size ? chip.image[addr] : 0xFF;
+
+	const size_t off = (size_t) addr * 2;
+	if (off + 1 >= chip.image_size)
+		return 0xFFFF;
+
+	const uint8_t a = chip.image[off+0];
+	const uint8_t b = chip.image[off+1];
+	if (p->options & OPTIONS_BIG_ENDIAN)
+		return (a << 8) | b;
+	return (b << 8) | a;
+}
+
+
+/** Is the chip powered and selected? */
+static uint8_t
+sim_enabled(void)
+{
+	const prom_t * const p = chip.prom;
+
+	for (uint8_t i = 0 ; i < array_count(chip.hi_id) ; i++)
+		if (chip.hi_id[i] && !sim_level(chip.hi_id[i]))
+			return 0;
+
+	for (uint8_t i = 0 ; i < array_count(chip.lo_id) ; i++)
+	{
+		if (chip.lo_id[i] == 0)
+			continue;
+		if ((p->options & OPTIONS_LATCH) && i == LATCH_PIN)
+			continue;
+		if (sim_level(chip.lo_id[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/** The outputs have changed; decode the address lines */
+static void
+sim_outputs(void)
+{
+	const prom_t * const p = chip.prom;
+	if (!p)
+		return;
+
+	uint32_t addr = 0;
+	for (uint8_t i = 0 ; i < p->addr_width ; i++)
+		if (chip.addr_id[i] && sim_level(chip.addr_id[i]))
+			addr |= ((uint32_t) 1) << i;
+
+	const sim_faults_t * const f = &chip.faults;
+	for (uint8_t i = 0 ; i < f->shorts ; i++)
+	{
+		const uint32_t a = ((uint32_t) 1) << f->short_a[i];
+		const uint32_t b = ((uint32_t) 1) << f->short_b[i];
+		if ((addr & a) == 0 || (addr & b) == 0)
+			addr &= ~(a | b);
+	}
+	addr = (addr & ~f->addr_stuck_mask) | f->addr_stuck_value;
+
+	if (p->options & OPTIONS_LATCH)
+	{
+		// Transparent while the latch pin is high,
+		// holds the address from the falling edge.
+		const uint8_t level = sim_level(chip.latch_id);
+		if (chip.latch_level && !level)
+			chip.latched = addr;
+		chip.latch_level = level;
+		if (!level)
+			addr = chip.latched;
+	}
+
+	if (addr == chip.addr)
+		return;
+
+	// Whatever was on the outputs starts to change
+	if (sim_stats.cycles - chip.changed_at >= chip.access_cycles)
+		chip.old_data = sim_data(chip.addr);
+
+	chip.addr = addr;
+	chip.changed_at = sim_stats.cycles;
+}
+
+
+/** Value on the chip's data lines right now */
+static uint16_t
+sim_outputs_data(void)
+{
+	uint16_t data = sim_data(chip.addr);
+
+	// Bits that are still changing read randomly
+	if (sim_stats.cycles - chip.changed_at < chip.access_cycles)
+	{
+		data ^= (data ^ chip.old_data) & sim_random();
+		sim_stats.early++;
+	}
+
+	const sim_faults_t * const f = &chip.faults;
+	data ^= (data ^ sim_random()) & f->floating;
+	data = (data & ~f->data_stuck_mask) | f->data_stuck_value;
+
+	sim_stats.samples++;
+	if (chip.addr != chip.sampled)
+	{
+		chip.sampled = chip.addr;
+		sim_stats.accesses++;
+	}
+
+	return data;
+}
+
+
+/** Value of a PINx register */
+static uint8_t
+sim_input(
+	const uint8_t port
+)
+{
+	const uint8_t index = port - 0xA;
+	if (index >= 6)
+		return 0;
+
+	uint8_t value = 0;
+	for (uint8_t bit = 0 ; bit < 8 ; bit++)
+		if (sim_level((port << 4) | bit))
+			value |= 1 << bit;
+
+	const prom_t * const p = chip.prom;
+	if (!p || !sim_enabled())
+		return value;
+
+	// Overlay the chip's outputs on any input pins it drives
+	uint16_t data = 0;
+	uint8_t have_data = 0;
+	for (uint8_t i = 0 ; i < p->data_width ; i++)
+	{
+		const uint8_t id = chip.data_id[i];
+		if (((id >> 4) & 0xF) != port)
+			continue;
+
+		const uint8_t bit = 1 << (id & 0x7);
+		if (sim_ddr[index] & bit)
+			continue;
+
+		if (!have_data)
+		{
+			data = sim_outputs_data();
+			have_data = 1;
+		}
+
+		if (data & (1 << i))
+			value |= bit;
+		else
+			value &= ~bit;
+	}
+
+	return value;
+}
+
+
+void
+sim_socket_insert(
+	const uint8_t * const ports,
+	const prom_t * const p,
+	const uint8_t * const image,
+	const size_t image_size,
+	const sim_faults_t * const faults,
+	const uint32_t seed
+)
+{
+	memset(&chip, 0, sizeof(chip));
+	if (!p)
+		return;
+
+	chip.prom = p;
+	chip.image = image;
+	chip.image_size = image_size;
+	chip.faults = *faults;
+	rng = seed ? seed : 1;
+
+	const uint16_t ns = faults->access_ns
+		? faults->access_ns
+		: p->access_ns ? p->access_ns : DEFAULT_ACCESS_NS;
+	chip.access_cycles = ((uint32_t) ns * (F_CPU / 1000000) + 999) / 1000;
+
+	// Same translation from package pins to the socket as prom_pin()
+	#define SIM_PIN(pin) ((pin) == 0 ? 0 : \
+		ports[(pin) <= p->pins / 2 ? (pin) : (pin) + SIM_ZIF_PINS - p->pins])
+
+	for (uint8_t i = 0 ; i < array_count(p->addr_pins) ; i++)
+		chip.addr_id[i] = SIM_PIN(p->addr_pins[i]);
+	for (uint8_t i = 0 ; i < array_count(p->data_pins) ; i++)
+		chip.data_id[i] = SIM_PIN(p->data_pins[i]);
+	for (uint8_t i = 0 ; i < array_count(p->hi_pins) ; i++)
+		chip.hi_id[i] = SIM_PIN(p->hi_pins[i]);
+	for (uint8_t i = 0 ; i < array_count(p->lo_pins) ; i++)
+		chip.lo_id[i] = SIM_PIN(p->lo_pins[i]);
+	chip.latch_id = chip.lo_id[LATCH_PIN];
+
+	sim_outputs();
+	chip.changed_at = 0;
+}
+
+
+void
+sim_socket_port(
+	const uint8_t port,
+	const uint8_t ddr,
+	const uint8_t value
+)
+{
+	const uint8_t index = port - 0xA;
+	if (index >= 6)
+		return;
+
+	sim_ddr[index] = ddr;
+	sim_port[index] = value;
+	sim_outputs();
+}
+
+
+uint8_t
+sim_socket_pin(
+	const uint8_t port
+)
+{
+	return sim_input(port);
+}
+
+
+uint64_t
+sim_socket_settled(void)
+{
+	return chip.changed_at + chip.access_cycles;
+}
+
+
+/*
+ * bits.c replacements
+ */
+
+void
+ddr(
+	const uint8_t id,
+	const uint8_t value
+)
+{
+	const uint8_t port = ((id >> 4) & 0xF) - 0xA;
+	const uint8_t bit = 1 << (id & 0x7);
+
+	sim_stats.port_ops++;
+	sim_stats.cycles += SIM_CYCLES_PIN;
+	if (port >= 6)
+		return;
+
+	if (value)
+		sim_ddr[port] |= bit;
+	else
+		sim_ddr[port] &= ~bit;
+	sim_outputs();
+}
+
+
+void
+out(
+	const uint8_t id,
+	const uint8_t value
+)
+{
+	const uint8_t port = ((id >> 4) & 0xF) - 0xA;
+	const uint8_t bit = 1 << (id & 0x7);
+
+	sim_stats.port_ops++;
+	sim_stats.cycles += SIM_CYCLES_PIN;
+	if (port >= 6)
+		return;
+
+	if (value)
+		sim_port[port] |= bit;
+	else
+		sim_port[port] &= ~bit;
+	sim_outputs();
+}
+
+
+uint8_t
+in(
+	const uint8_t id
+)
+{
+	sim_stats.port_ops++;
+	sim_stats.cycles += SIM_CYCLES_PIN;
+	return sim_input((id >> 4) & 0xF) & (1 << (id & 0x7));
+}
+
+
+void
+port_write(
+	const uint8_t port,
+	const uint8_t mask,
+	const uint8_t value
+)
+{
+	const uint8_t index = port - 0xA;
+
+	sim_stats.port_ops++;
+	sim_stats.cycles += SIM_CYCLES_PORT;
+	if (index >= 6)
+		return;
+
+	sim_port[index] = (sim_port[index] & ~mask) | value;
+	sim_outputs();
+}
+
+
+uint8_t
+port_read(
+	const uint8_t port
+)
+{
+	sim_stats.port_ops++;
+	sim_stats.cycles += SIM_CYCLES_PORT;
+	return sim_input(port);
+}
@@ -0,0 +1,110 @@
+/** \file
+ * Simulated AVR ports wired to a virtual chip in the ZIF socket.
+ *
+ * Replaces bits.c: ddr(), out(), in(), port_write() and port_read()
+ * update a model of the six AVR ports, and every change to the
+ * outputs is shown to the virtual chip.  The chip decodes its
+ * address from the pins according to its own prom_t pinout and
+ * drives its data pins from an image file once its access time has
+ * passed on the virtual clock.
+ */
+#ifndef _sim_socket_h_
+#define _sim_socket_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chips.h"
+
+/** Rough cost in cycles of a call into bits.c with avr-gcc -Os,
+ * including the call, the port switch and the read-modify-write.
+ */
+#define SIM_CYCLES_PIN 20
+#define SIM_CYCLES_PORT 14
+
+/** Most shorted pairs of address lines */
+#define SIM_SHORTS 8
+
+
+typedef struct
+{
+	/** Virtual time in CPU cycles */
+	uint64_t cycles;
+
+	/** Calls to ddr(), out(), in(), port_write() and port_read() */
+	uint64_t port_ops;
+
+	/** Reads of the data pins, and how many were at a new address */
+	uint64_t samples;
+	uint64_t accesses;
+
+	/** Samples taken before the chip's access time had passed */
+	uint64_t early;
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+
+/** Faults to inject in the virtual chip */
+typedef struct
+{
+	/** Override the chip's access time, in ns, if non-zero */
+	uint16_t access_ns;
+
+	/** Data bits that are not driven and read randomly */
+	uint16_t floating;
+
+	/** Address lines stuck at a level, regardless of the pin */
+	uint32_t addr_stuck_mask;
+	uint32_t addr_stuck_value;
+
+	/** Data lines stuck at a level */
+	uint16_t data_stuck_mask;
+	uint16_t data_stuck_value;
+
+	/** Pairs of address lines shorted together (wired AND) */
+	uint8_t shorts;
+	uint8_t short_a[SIM_SHORTS];
+	uint8_t short_b[SIM_SHORTS];
+} sim_faults_t;
+
+
+/** Insert a virtual chip, or empty the socket if chip is NULL.
+ * \param ports The sketch's ZIF pin to AVR pin map.
+ * \param image Contents of the chip, in the same byte order as a dump.
+ */
+extern void
+sim_socket_insert(
+	const uint8_t * ports,
+	const prom_t * chip,
+	const uint8_t * image,
+	size_t image_size,
+	const sim_faults_t * faults,
+	uint32_t seed
+);
+
+
+/*
+ * For a CPU model other than the sketch built for the host, such as
+ * simavr, that keeps its own port registers and clock.  Set
+ * sim_stats.cycles to the current cycle before each call.
+ */
+
+/** Set a port's DDRx and PORTx registers (port is 0xA to 0xF) */
+extern void
+sim_socket_port(
+	uint8_t port,
+	uint8_t ddr,
+	uint8_t value
+);
+
+/** Value the chip and pull ups put on a port's PINx register */
+extern uint8_t
+sim_socket_pin(
+	uint8_t port
+);
+
+/** Cycle at which the chip's outputs settle after the last change */
+extern uint64_t
+sim_socket_settled(void);
+
+#endif